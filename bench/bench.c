@@ -0,0 +1,322 @@
+// benchmark driver of seeHell (make bench)
+// runs the built shell in LOCAL, AF_UNIX (-u) and AF_INET (-p) modes with scripted workloads
+// every result is printed as a JSON object on its own line (commands/s, p50/p99 round-trip latency, bytes/s relayed)
+// usage: bench <shell binary> [-n scale] [-c clients] [-p port]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../protocol.h"
+
+#define BENCH_LATENCY_MAX 1000000
+#define BENCH_CLIENTS_MAX 256
+
+// workloads (scale multiplies the command counts)
+#define BENCH_TRIVIAL "/bin/true" // spawned, a path is never looked up among the builtins
+#define BENCH_BUILTIN "true"
+#define BENCH_PIPELINE "cat /etc/passwd | cat | cat | cat | cat | cat | cat | wc -l"
+#define BENCH_OUTPUT "head -c 67108864 /dev/zero"
+
+typedef struct {
+    const char *mode;
+    const char *workload;
+    int clients;
+    long commands;
+    double seconds;
+    long long bytes;                    // output relayed to the benchmark
+    double *latency;                    // round-trip of every command in microseconds (none in LOCAL)
+    int latency_count;
+} result_t;
+
+// connection of a benchmark client
+typedef struct {
+    int fd;
+    char *in;                           // received frames not parsed yet
+    int in_len;
+    long left;                          // commands still to send
+    double sent;                        // time the running command was sent
+} client_t;
+
+char *shell;                            // binary under test
+char workers_arg[16] = "1";             // server processes (-w)
+double latency[BENCH_LATENCY_MAX];
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// print the result as one JSON line
+void report(result_t *r) {
+    printf("{\"mode\":\"%s\",\"workload\":\"%s\",\"clients\":%d,\"commands\":%ld,\"seconds\":%.6f,"
+           "\"commands_per_sec\":%.1f,\"bytes\":%lld,\"bytes_per_sec\":%.0f",
+           r->mode, r->workload, r->clients, r->commands, r->seconds,
+           r->commands / r->seconds, r->bytes, r->bytes / r->seconds);
+    if (r->latency_count > 0) {
+        qsort(r->latency, r->latency_count, sizeof(double), compareDouble);
+        printf(",\"p50_us\":%.1f,\"p99_us\":%.1f",
+               r->latency[r->latency_count / 2], r->latency[(int)(r->latency_count * 0.99)]);
+    } else printf(",\"p50_us\":null,\"p99_us\":null");
+    printf("}\n");
+    fflush(stdout);
+}
+
+// --------------------------------------
+// LOCAL: the shell runs a generated script (batch mode), its STDOUT is counted
+// --------------------------------------
+
+void benchLocal(const char *workload, const char *cmd, long n) {
+    char script[] = "/tmp/seehell-bench-XXXXXX";
+    char buffer[65536];
+    result_t r = {"local", workload, 1, n, 0, 0, NULL, 0};
+    int fd, out[2];
+    long i;
+    ssize_t got;
+    pid_t pid;
+
+    if ((fd = mkstemp(script)) == -1) {
+        perror("bench script");
+        return;
+    }
+    FILE *f = fdopen(fd, "w");
+    for (i = 0; i < n; i++) fprintf(f, "%s\n", cmd);
+    fclose(f);
+
+    if (pipe(out) != 0) {
+        perror("bench pipe");
+        unlink(script);
+        return;
+    }
+    double start = now();
+    if ((pid = fork()) == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execl(shell, shell, "-f", script, (char *)NULL);
+        perror("bench exec");
+        _exit(127);
+    }
+    close(out[1]);
+    while ((got = read(out[0], buffer, sizeof(buffer))) > 0 || (got == -1 && errno == EINTR))
+        if (got > 0) r.bytes += got;
+    close(out[0]);
+    waitpid(pid, NULL, 0);
+    r.seconds = now() - start;
+    unlink(script);
+    report(&r);
+}
+
+// --------------------------------------
+// SERVER: clients speak the framed protocol (protocol.h)
+// --------------------------------------
+
+// connect to the server under test, retried while it starts
+int clientConnect(const char *path, int port) {
+    double deadline = now() + 5;
+    while (now() < deadline) {
+        int fd;
+        if (path != NULL) {
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        } else {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int)); // as the shell's client
+                return fd;
+            }
+        }
+        close(fd);
+        usleep(10000);
+    }
+    fprintf(stderr, "bench: can't connect to the server\n");
+    return -1;
+}
+
+// read what arrived on the connection, output payload bytes are added to (*bytes)
+// returns the number of responses that ended, -1 on error
+int clientReceive(client_t *c, long long *bytes) {
+    proto_header_t header;
+    int ended = 0;
+    ssize_t got = read(c->fd, c->in + c->in_len, PROTO_HEADER_SIZE + PROTO_PAYLOAD_MAX - c->in_len);
+    if (got == -1 && errno == EINTR) return 0;
+    if (got <= 0) return -1;
+    c->in_len += got;
+    int at = 0;
+    while (c->in_len - at >= PROTO_HEADER_SIZE) {
+        protoDecode(c->in + at, &header);
+        if (header.length > PROTO_PAYLOAD_MAX) return -1;
+        if (c->in_len - at < PROTO_HEADER_SIZE + (int)header.length) break;
+        if (header.type == PROTO_OUT) (*bytes) += header.length;
+        else if (header.type == PROTO_END) ended++;
+        at += PROTO_HEADER_SIZE + header.length;
+    }
+    memmove(c->in, c->in + at, c->in_len - at);
+    c->in_len -= at;
+    return ended;
+}
+
+// send the next command of the client
+char clientSend(client_t *c, const char *cmd) {
+    c->sent = now();
+    c->left--;
+    return protoSend(c->fd, PROTO_CMD, 0, 0, 0, 0, cmd, strlen(cmd)) != 0;
+}
+
+// n commands spread over the clients, every client keeps one command in flight
+void benchServer(const char *mode, const char *path, int port, const char *workload, const char *cmd, long n, int clients) {
+    client_t c[BENCH_CLIENTS_MAX];
+    struct pollfd pfd[BENCH_CLIENTS_MAX];
+    result_t r = {mode, workload, clients, n, 0, 0, latency, 0};
+    int i, active = 0;
+
+    // connect and consume the greeting
+    for (i = 0; i < clients; i++) {
+        c[i].in = malloc(PROTO_HEADER_SIZE + PROTO_PAYLOAD_MAX);
+        c[i].in_len = 0;
+        c[i].left = n / clients + (i < n % clients);
+        if ((c[i].fd = clientConnect(path, port)) == -1) return;
+        while (clientReceive(&(c[i]), &(r.bytes)) == 0);
+    }
+    r.bytes = 0;
+
+    double start = now();
+    for (i = 0; i < clients; i++) {
+        pfd[i].fd = c[i].fd;
+        pfd[i].events = POLLIN;
+        if (c[i].left > 0 && clientSend(&(c[i]), cmd) == 0) active++;
+    }
+    while (active > 0) {
+        if (poll(pfd, clients, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("bench poll");
+            break;
+        }
+        for (i = 0; i < clients; i++) {
+            if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            int ended = clientReceive(&(c[i]), &(r.bytes));
+            if (ended == -1) {
+                fprintf(stderr, "bench: connection lost\n");
+                pfd[i].fd = -1;
+                active--;
+                continue;
+            }
+            if (ended == 0) continue;
+            if (r.latency_count < BENCH_LATENCY_MAX) latency[r.latency_count++] = (now() - c[i].sent) * 1e6;
+            if (c[i].left == 0 || clientSend(&(c[i]), cmd) != 0) {
+                pfd[i].fd = -1;
+                active--;
+            }
+        }
+    }
+    r.seconds = now() - start;
+
+    for (i = 0; i < clients; i++) {
+        protoSend(c[i].fd, PROTO_CMD, 0, 0, 0, 0, "quit", 4);
+        close(c[i].fd);
+        free(c[i].in);
+    }
+    report(&r);
+}
+
+// start the shell as a server on the path or port, its own output is discarded
+pid_t serverStart(const char *path, int port) {
+    char port_arg[16];
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        snprintf(port_arg, sizeof(port_arg), "%d", port);
+        if (path != NULL) execl(shell, shell, "-u", path, "-w", workers_arg, (char *)NULL);
+        else execl(shell, shell, "-p", port_arg, "-w", workers_arg, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+void serverStop(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+// every workload against a server on the path (AF_UNIX) or port (AF_INET)
+void benchSocket(const char *mode, const char *path, int port, long scale, int clients) {
+    pid_t pid = serverStart(path, port);
+    int fd = clientConnect(path, port); // wait until it listens
+    if (fd == -1) {
+        serverStop(pid);
+        return;
+    }
+    close(fd);
+    benchServer(mode, path, port, "trivial", BENCH_TRIVIAL, 2000 * scale, 1);
+    benchServer(mode, path, port, "builtin", BENCH_BUILTIN, 2000 * scale, 1);
+    benchServer(mode, path, port, "pipeline", BENCH_PIPELINE, 200 * scale, 1);
+    benchServer(mode, path, port, "output", BENCH_OUTPUT, 4 * scale, 1);
+    benchServer(mode, path, port, "concurrent", BENCH_TRIVIAL, 2000 * scale, clients);
+    serverStop(pid);
+}
+
+int main(int argc, char *argv[]) {
+    char path[64];
+    long scale = 1;
+    int clients = 16;
+    int port = 48213;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <shell binary> [-n scale] [-c clients] [-p port] [-w workers]\n", argv[0]);
+        return 1;
+    }
+    shell = argv[1];
+    for (i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) scale = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0) clients = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-p") == 0) port = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-w") == 0) snprintf(workers_arg, sizeof(workers_arg), "%d", atoi(argv[i + 1]));
+    }
+    if (scale < 1) scale = 1;
+    if (clients < 1 || clients > BENCH_CLIENTS_MAX) clients = 16;
+    signal(SIGPIPE, SIG_IGN);
+
+    benchLocal("trivial", BENCH_TRIVIAL, 2000 * scale);
+    benchLocal("builtin", BENCH_BUILTIN, 2000 * scale);
+    benchLocal("pipeline", BENCH_PIPELINE, 200 * scale);
+    benchLocal("output", BENCH_OUTPUT, 4 * scale);
+
+    snprintf(path, sizeof(path), "/tmp/seehell-bench-%d.sock", (int)getpid());
+    benchSocket("unix", path, 0, scale, clients);
+    unlink(path);
+    benchSocket("inet", NULL, port, scale, clients);
+    return 0;
+}
@@ -39,6 +39,7 @@ x 30.(1 bod) Dobré komentáre, resp. rozšírená dokumentácia, v anglickom ja
 
 */
 
+#define _GNU_SOURCE // pipe2, accept4
 #include <stdio.h> // main entry point, printf
 #include <string.h> // strcat
 #include <stdlib.h> // malloc
@@ -46,13 +47,29 @@ x 30.(1 bod) Dobré komentáre, resp. rozšírená dokumentácia, v anglickom ja
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <fcntl.h> // O_ definitions
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <arpa/inet.h>       
 #include <errno.h>
+#include <limits.h> // INT_MAX
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/ioctl.h> // FIONREAD
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h> // flock
+#include <sys/sendfile.h>
+#include <sched.h> // CPU affinity of parallel
+#include <dirent.h> // DT_ types of getdents64 entries
+#include <stdint.h>
 #include "syscall.h"
+#include "protocol.h"
 
 // enums
 #define ERR_MALLOC 1
@@ -73,15 +90,25 @@ x 30.(1 bod) Dobré komentáre, resp. rozšírená dokumentácia, v anglickom ja
 
 // configurables
 #define SHELL_SOCKNAME_MAX 108
-#define SHELL_USERINPUT_MAX 4096
-#define SHELL_HISTORY_MAX 20
+#define SHELL_USERINPUT_MAX 4096 // initial size of the line buffers (they grow up to shellLineMax())
+#define SHELL_HISTORY_MAX 100000 // commands kept in the history
+#define SHELL_HISTORY_BYTES 8388608 // history ring size of a new history file
+#define SHELL_HISTORY_FILE ".seehell_history" // in the home directory (unless $SEEHELL_HISTFILE is set)
+#define SHELL_EPOLL_EVENTS 64
+#define SHELL_READER_BUFFER 65536 // command input is read in blocks of this size
+#define SHELL_CONN_OUTPUT_MAX 262144 // pending output per connection before job output stops being read
+#define SHELL_SESSIONS_MAX 64 // sessions of a connection (protocol.h)
+#define SHELL_SESSION_QUEUE_MAX 1048576 // queued command frames of a session before the connection stops being read
+#define SHELL_HASH_BUCKETS 256 // command lookup cache
+#define SHELL_VARS_BUCKETS 256 // shell variables
+#define SHELL_GLOB_DIRS 32 // directory listings kept for pathname expansion
+#define SHELL_GLOB_BUFFER 65536 // getdents64 batch
+#define SHELL_ARENA_BLOCK 8192 // parser arena block size (larger lines get a block of their own)
 
 #define PROMPT_DELIMITER '|'
 #define PROMPT_HOSTNAME_MAX _SC_HOST_NAME_MAX
-
-#define PARG_NTYPE_FINISHED 0
-#define PARG_NTYPE_SEMICOLON 1
-#define PARG_NTYPE_PIPE 2
+#define PROMPT_NAME_MAX 256
+#define PROMPT_MAX (PROMPT_NAME_MAX + PROMPT_HOSTNAME_MAX + 16) // time, user name, host name and delimiter
 
 #define IS_PIPE_BOTH 2
 #define IS_PIPE_RIGHT 1
@@ -102,14 +129,47 @@ const char help[] = "\n\
 \t              Unless -c is specified, shell runs as a server\n\
 \t-c            Switches from server to client (with -p, -u specified)\n\
 \t-h            Displays help (this message)\n\
+\t-f <file>     Runs the commands of the file without prompts (unsocketed)\n\
+\t              Commands piped to STDIN are run the same way\n\
+\t-t            Logs resource usage of every command (as \"time\" does)\n\
+\t-m <seconds>  Dumps server metrics into its log periodically (also on SIGUSR1)\n\
+\t-w <number>   Pre-forks that many server processes, the kernel spreads connections among them\n\
+\t-b <number>   Listen backlog of the server (default: SOMAXCONN)\n\
+\t-i <address>  IPv4 address the server binds and the client connects to with -p (default: 127.0.0.1)\n\
 - Built-in commands:\n\
 \thalt          Ends the shell execution\n\
 \tquit          Requests server to end the connection, then halt\n\
+\tsession [list] Lists the sessions of the client connection (* is current)\n\
+\tsession new   Opens a new session on the connection and switches to it\n\
+\tsession switch n  Sends the next commands to session n\n\
+\tsession close [n] Closes session n (the current one without n)\n\
+\t              (these are whole command lines, the following work in any stage of ; and |)\n\
 \thelp          Displays help (this message)\n\
-\thistory       Prints history of commands up to 20\n\
-\tcd            Changes the working directory\n\
+\thistory [n]   Prints history of commands (the last n), kept across runs\n\
+\t              (on the server: the commands of the session)\n\
+\thistory -s p  Prints commands of the history containing p\n\
+\thash [-r]      Lists remembered command locations, -r forgets them\n\
+\tstats         Prints server metrics (from a client)\n\
+\ttime <cmd>    Runs the pipeline cmd, then prints real/user/sys time, max RSS, context switches\n\
+\tjobs          Lists background jobs\n\
+\twait [%n]     Waits for job n (all jobs without n)\n\
+\tfg [%n]       Waits for job n in the foreground (the last job without n)\n\
+\tkill [-s] %n|pid  Sends signal s (TERM by default) to job n or a process\n\
+\tparallel [-j N] [-a] cmd [::: args]\n\
+\t              Runs cmd for every arg (or STDIN line), N at once (default: CPUs)\n\
+\t              {} in cmd is replaced by the arg, -a pins jobs to CPUs\n\
+\tcd [dir]      Changes the working directory\n\
+\techo [-n] ... Prints the arguments\n\
+\tpwd           Prints the working directory\n\
+\tprintf f ...  Prints the arguments in format f (%s %b %c %d %i %u %o %x)\n\
+\ttest, [ ]     Evaluates a file, string or integer test\n\
+\ttrue, false   Exit with status 0 (1)\n\
+\texport [n[=v]] Passes variable n to commands (lists exported ones without n)\n\
+\tunset n ...   Removes variables\n\
+\tset           Lists all variables\n\
 - Built-in operators:\n\
 \t;             Ends the given command, can be followed by another\n\
+\t&             Same as ; but the command runs in the background (as a job)\n\
 \t|             Pipes the STDOUT of previous command to STDIN of next\n\
 \t<             File input for the given command (precedence over pipe)\n\
 \t>             File output for the given command (precedence over pipe)\n\
@@ -117,16 +177,37 @@ const char help[] = "\n\
 \tspace         Trimmed if outside quotes and unescaped\n\
 \t\"             Quoted input is handled as a single argument\n\
 \t\\             Escape support for all built-in operators\n\
+\t$n, ${n}, $?  Value of variable n, exit status of the previous line\n\
+\tn=v [cmd]     Sets variable n (only for cmd if given)\n\
+\t* ? [...]     Replaced by the matching paths (sorted), kept if none match\n\
 - Any other commands are executed on OS level.\n\
 ";
 
 // man 3 exec
 extern char **environ;
 
+// signal mask restored in forked children (the server blocks SIGCHLD for its signalfd)
+sigset_t shell_sigmask_child;
+
+// log the resource usage of every command (-t)
+char shell_timing = 0;
+
+// SERVER metrics are dumped into its log every this many seconds (-m), 0 if disabled
+int shell_metrics_interval = 0;
+
+// SERVER processes accepting connections (-w), 1 serves them in the shell process itself
+int shell_workers = 1;
+
+// pending connections the kernel queues on a listening socket (-b)
+int shell_backlog = SOMAXCONN;
+
+// IPv4 address the SERVER binds and the CLIENT connects to (-i, with -p)
+char *shell_address = "127.0.0.1";
+
 // processes supported arguments into respective variables
 // sizeof(shell_sockname) => shell_sockname_size for constant-sized char arrays
 // returns 1 on error, 0 if no error
-char processArgs(int argc, char* argv[], char* shell_type, int* shell_port, char* shell_sockname, unsigned int shell_sockname_size) {
+char processArgs(int argc, char* argv[], char* shell_type, int* shell_port, char* shell_sockname, unsigned int shell_sockname_size, char** shell_script) {
     int i;
     char flag = '\0';
     for (i = 1; i < argc; i++) {
@@ -134,14 +215,20 @@ char processArgs(int argc, char* argv[], char* shell_type, int* shell_port, char
             case '\0': // get the next arg flag
                 if      (strcmp(argv[i], "-p") == 0) flag = 'p'; // takes a value
                 else if (strcmp(argv[i], "-u") == 0) flag = 'u'; // takes a value
+                else if (strcmp(argv[i], "-f") == 0) flag = 'f'; // takes a value
+                else if (strcmp(argv[i], "-m") == 0) flag = 'm'; // takes a value
+                else if (strcmp(argv[i], "-w") == 0) flag = 'w'; // takes a value
+                else if (strcmp(argv[i], "-b") == 0) flag = 'b'; // takes a value
+                else if (strcmp(argv[i], "-i") == 0) flag = 'i'; // takes a value
                 else if (strcmp(argv[i], "-c") == 0) {flag = 'c'; i--;} // doesn't take values
                 else if (strcmp(argv[i], "-h") == 0) {flag = 'h'; i--;} // doesn't take values
+                else if (strcmp(argv[i], "-t") == 0) shell_timing = 1; // doesn't take values
                 else    {fprintf(stderr, "Unrecognized argument [%s].\n", argv[i]); return 1; }
                 break;
             case 'p': // set port (and server if not flagged as a client)
                 (*shell_type) = ((*shell_type) == SHELL_TYPE_LOCAL) ? SHELL_TYPE_SERVER : (*shell_type);
-                if (((*shell_port) = atoi(argv[i])) == 0) {
-                    fprintf(stderr, "Argument [-p] must be followed by a non-zero port number.\n");
+                if (((*shell_port) = atoi(argv[i])) <= 0 || (*shell_port) > 65535) {
+                    fprintf(stderr, "Argument [-p] must be followed by a port number (1-65535).\n");
                     return 1;
                 }
                 flag = '\0';
@@ -151,6 +238,35 @@ char processArgs(int argc, char* argv[], char* shell_type, int* shell_port, char
                 strncpy(shell_sockname, argv[i], shell_sockname_size); // _todo no checks are made for socket name input
                 flag = '\0';
                 break;
+            case 'm': // periodic metrics dump
+                if ((shell_metrics_interval = atoi(argv[i])) <= 0) {
+                    fprintf(stderr, "Argument [-m] must be followed by a positive number of seconds.\n");
+                    return 1;
+                }
+                flag = '\0';
+                break;
+            case 'w': // pre-forked server workers
+                if ((shell_workers = atoi(argv[i])) <= 0) {
+                    fprintf(stderr, "Argument [-w] must be followed by a positive number of workers.\n");
+                    return 1;
+                }
+                flag = '\0';
+                break;
+            case 'b': // listen backlog
+                if ((shell_backlog = atoi(argv[i])) <= 0) {
+                    fprintf(stderr, "Argument [-b] must be followed by a positive backlog size.\n");
+                    return 1;
+                }
+                flag = '\0';
+                break;
+            case 'i': // address of the port-based socket
+                shell_address = argv[i];
+                flag = '\0';
+                break;
+            case 'f': // run commands of a script
+                (*shell_script) = argv[i];
+                flag = '\0';
+                break;
             case 'c': // flag as a client
                 (*shell_type) = SHELL_TYPE_CLIENT;
                 flag = '\0';
@@ -169,415 +285,4228 @@ char processArgs(int argc, char* argv[], char* shell_type, int* shell_port, char
         fprintf(stderr, "Argument [-c] must be used alongside a port number or socket name.\n");
         return 1;
     }
-    return 0;
+    if ((*shell_type) != SHELL_TYPE_LOCAL && (*shell_script) != NULL) {
+        fprintf(stderr, "Argument [-f] can't be used alongside a port number or socket name.\n");
+        return 1;
+    }
+    return 0;
+}
+
+// prompt components that rarely change, resolved once and reused for every prompt
+// (user and host on startup and on SIGHUP, time once a minute)
+typedef struct {
+    char name[PROMPT_NAME_MAX];         // user name
+    char home[PATH_MAX];                // home directory (cd without arguments)
+    char hostname[PROMPT_HOSTNAME_MAX];
+    char prompt[PROMPT_MAX];            // formatted prompt
+    int prompt_len;
+    time_t minute_end;                  // unix time the formatted minute ends at (0 = rebuild)
+} prompt_cache_t;
+
+prompt_cache_t prompt_cache;
+volatile sig_atomic_t prompt_stale = 1; // user or host have to be resolved again
+
+// SIGHUP: hostname change, su-style user change (applied before the next prompt)
+void promptHangup(int sig) {
+    prompt_stale = 1;
+}
+
+// resolve user and host again
+void promptRefresh() {
+    struct passwd *pw = getpwuid(sc_getuid());
+    snprintf(prompt_cache.name, sizeof(prompt_cache.name), "%s", (pw != NULL) ? pw->pw_name : "?");
+    snprintf(prompt_cache.home, sizeof(prompt_cache.home), "%s", (pw != NULL) ? pw->pw_dir : "/");
+    if (gethostname(prompt_cache.hostname, sizeof(prompt_cache.hostname)) != 0) strcpy(prompt_cache.hostname, "?");
+    prompt_cache.hostname[sizeof(prompt_cache.hostname) - 1] = '\0';
+    prompt_cache.minute_end = 0;
+    prompt_stale = 0;
+}
+
+// install the SIGHUP refresh (LOCAL and SERVER, the client shows prompts of the server)
+void promptInit() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = promptHangup;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+    promptRefresh();
+}
+
+// gets the prompt roughly as follows: TIME GETPWUID(GETUID)@HOSTNAME:
+// the prompt is stored into buffer of the given size, returns its length
+// clock_gettime is served by the vDSO (no syscall), the prompt is only formatted again once the minute changes
+int formatPrompt(char *buffer, int size) {
+    // unix time
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    if (prompt_stale) promptRefresh();
+    if (now.tv_sec >= prompt_cache.minute_end) {
+        // human readable time
+        struct tm htime;
+        localtime_r(&(now.tv_sec), &htime);
+        prompt_cache.minute_end = now.tv_sec - htime.tm_sec + 60;
+
+        prompt_cache.prompt_len = snprintf(prompt_cache.prompt, sizeof(prompt_cache.prompt), "%02d:%02d %s@%s%c ",
+            htime.tm_hour,
+            htime.tm_min,
+            prompt_cache.name,
+            prompt_cache.hostname,
+            PROMPT_DELIMITER
+            );
+        if (prompt_cache.prompt_len >= (int)sizeof(prompt_cache.prompt)) prompt_cache.prompt_len = sizeof(prompt_cache.prompt) - 1;
+    }
+
+    if (prompt_cache.prompt_len >= size) return snprintf(buffer, size, "%s", prompt_cache.prompt);
+    memcpy(buffer, prompt_cache.prompt, prompt_cache.prompt_len + 1);
+    return prompt_cache.prompt_len;
+}
+
+// output an up-to-date prompt
+void printPrompt() {
+    char prompt[PROMPT_MAX];
+    formatPrompt(prompt, sizeof(prompt));
+    fputs(prompt, stdout);
+}
+
+// remove spaces from the left
+char *ltrim(char* str) {
+    while((*str) == ' ') str++;
+    return str;
+}
+
+// remove spaces from the right
+char *rtrim(char* str) {
+    char *end = str + strlen(str);
+    while((*(--end)) == ' ');
+    *(++end) = '\0';
+    return str;
+}
+
+// remove spaces from both left and right
+char *trim(char* str) {
+    return ltrim(rtrim(str)); 
+}
+
+// --------------------------------------
+// shell variables and the environment of commands
+// --------------------------------------
+
+// djb2 hash of the first len characters of str
+unsigned int hashString(const char *str, int len) {
+    unsigned int h = 5381;
+    while (len-- > 0) h = h * 33 + (unsigned char)(*str++);
+    return h;
+}
+
+// shell variable, exported ones are passed to commands
+typedef struct var {
+    char *entry;                        // "NAME=value" (the form envp needs)
+    int name_len;
+    char exported;
+    struct var *next;
+} var_t;
+
+// variables of a shell (on the SERVER every session has its own, see sessionEnter)
+typedef struct {
+    var_t *buckets[SHELL_VARS_BUCKETS];
+    char **envp;                        // exported variables for execve, rebuilt only after an exported one changed
+    int envp_size;
+    char envp_stale;
+} vars_t;
+
+vars_t vars_env = {.envp_stale = 1};    // the environment the shell was started with (the LOCAL shell's variables)
+vars_t *shell_vars = &vars_env;         // variables of the running shell or session
+int shell_status = 0;                   // exit status of the last command ($?)
+
+// length of a valid variable name at the start of str (letters, digits, '_', not starting with a digit)
+int varNameLen(const char *str) {
+    int len = 0;
+    if ((*str) >= '0' && (*str) <= '9') return 0;
+    while ((str[len] >= 'a' && str[len] <= 'z') || (str[len] >= 'A' && str[len] <= 'Z')
+           || (str[len] >= '0' && str[len] <= '9') || str[len] == '_') len++;
+    return len;
+}
+
+// variable named by the first len characters of name, NULL if not set
+var_t *varFind(const char *name, int len) {
+    var_t *v;
+    for (v = shell_vars->buckets[hashString(name, len) % SHELL_VARS_BUCKETS]; v != NULL; v = v->next)
+        if (v->name_len == len && strncmp(v->entry, name, len) == 0) return v;
+    return NULL;
+}
+
+// value of the variable, NULL if not set
+const char *varGet(const char *name) {
+    var_t *v = varFind(name, strlen(name));
+    return (v != NULL) ? v->entry + v->name_len + 1 : NULL;
+}
+
+// set a variable from a "NAME=value" assignment (export: 1 exports it, 0 keeps its current export state)
+// returns 1 on error (invalid name, memory allocation error)
+char varAssign(const char *assignment, char export) {
+    int len = varNameLen(assignment);
+    var_t *v;
+    char *entry;
+    if (len == 0 || assignment[len] != '=') {
+        fprintf(stderr, "%s: not a valid assignment\n", assignment);
+        return 1;
+    }
+    if ((entry = strdup(assignment)) == NULL) {
+        fprintf(stderr, "Memory allocation error.\n");
+        return 1;
+    }
+    if ((v = varFind(assignment, len)) == NULL) {
+        if ((v = calloc(1, sizeof(var_t))) == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            free(entry);
+            return 1;
+        }
+        unsigned int bucket = hashString(assignment, len) % SHELL_VARS_BUCKETS;
+        v->name_len = len;
+        v->next = shell_vars->buckets[bucket];
+        shell_vars->buckets[bucket] = v;
+    }
+    free(v->entry);
+    v->entry = entry;
+    v->exported |= export;
+    if (v->exported) shell_vars->envp_stale = 1; // commands see the new value
+    return 0;
+}
+
+// set a variable (see varAssign)
+char varSet(const char *name, const char *value, char export) {
+    char *assignment = malloc(strlen(name) + strlen(value) + 2);
+    if (assignment == NULL) return 1;
+    sprintf(assignment, "%s=%s", name, value);
+    char r = varAssign(assignment, export);
+    free(assignment);
+    return r;
+}
+
+// remove a variable
+void varUnset(const char *name) {
+    int len = strlen(name);
+    var_t **at;
+    for (at = &(shell_vars->buckets[hashString(name, len) % SHELL_VARS_BUCKETS]); (*at) != NULL; at = &((*at)->next)) {
+        var_t *v = (*at);
+        if (v->name_len != len || strncmp(v->entry, name, len) != 0) continue;
+        if (v->exported) shell_vars->envp_stale = 1;
+        (*at) = v->next;
+        free(v->entry);
+        free(v);
+        return;
+    }
+}
+
+// import the environment the shell was started with (all exported)
+void varsInit() {
+    char **env;
+    for (env = environ; (*env) != NULL; env++)
+        if (varNameLen((*env)) > 0 && (*env)[varNameLen((*env))] == '=') varAssign((*env), 1);
+}
+
+// copy the variables of from into to (a new session starts with the server's environment)
+// returns 1 on a memory allocation error (what was copied is kept, see varsFree)
+char varsCopy(vars_t *to, const vars_t *from) {
+    var_t *v, *copy;
+    int i;
+    memset(to, 0, sizeof(vars_t));
+    to->envp_stale = 1;
+    for (i = 0; i < SHELL_VARS_BUCKETS; i++) {
+        for (v = from->buckets[i]; v != NULL; v = v->next) {
+            if ((copy = malloc(sizeof(var_t))) == NULL) return 1;
+            if ((copy->entry = strdup(v->entry)) == NULL) {
+                free(copy);
+                return 1;
+            }
+            copy->name_len = v->name_len;
+            copy->exported = v->exported;
+            copy->next = to->buckets[i];
+            to->buckets[i] = copy;
+        }
+    }
+    return 0;
+}
+
+// free all variables of vars
+void varsFree(vars_t *vars) {
+    var_t *v;
+    int i;
+    for (i = 0; i < SHELL_VARS_BUCKETS; i++) {
+        while ((v = vars->buckets[i]) != NULL) {
+            vars->buckets[i] = v->next;
+            free(v->entry);
+            free(v);
+        }
+    }
+    free(vars->envp);
+    vars->envp = NULL;
+    vars->envp_size = 0;
+    vars->envp_stale = 1;
+}
+
+// envp of commands: the exported variables, the array is only rebuilt after an exported variable changed
+// (the entries are the variables' own "NAME=value" strings, nothing is copied)
+char **varsEnvp() {
+    vars_t *vars = shell_vars;
+    var_t *v;
+    int i, count = 0;
+    if (!vars->envp_stale) return vars->envp;
+    for (i = 0; i < SHELL_VARS_BUCKETS; i++)
+        for (v = vars->buckets[i]; v != NULL; v = v->next) count += v->exported;
+    if (count + 1 > vars->envp_size) {
+        char **grown = realloc(vars->envp, (count + 1) * sizeof(char *));
+        if (grown == NULL) return (vars->envp != NULL) ? vars->envp : environ; // previous environment
+        vars->envp = grown;
+        vars->envp_size = count + 1;
+    }
+    count = 0;
+    for (i = 0; i < SHELL_VARS_BUCKETS; i++)
+        for (v = vars->buckets[i]; v != NULL; v = v->next)
+            if (v->exported) vars->envp[count++] = v->entry;
+    vars->envp[count] = NULL;
+    vars->envp_stale = 0;
+    return vars->envp;
+}
+
+// envp of a command with "NAME=value" prefix assignments: the cached envp with the assignments replacing
+// or adding entries (only the pointer array is new, free it after the command started)
+// returns NULL on a memory allocation error
+char **varsOverlay(char *const assigns[], int count) {
+    char **envp = varsEnvp();
+    int n, i, j, used = 0;
+    for (n = 0; envp[n] != NULL; n++);
+    char **overlay = malloc((n + count + 1) * sizeof(char *));
+    if (overlay == NULL) return NULL;
+    for (i = 0; i < n; i++) {
+        int len = strchr(envp[i], '=') - envp[i];
+        for (j = 0; j < count && !(strncmp(assigns[j], envp[i], len + 1) == 0); j++);
+        if (j == count) overlay[used++] = envp[i];
+    }
+    for (j = 0; j < count; j++) overlay[used++] = assigns[j];
+    overlay[used] = NULL;
+    return overlay;
+}
+
+// export [NAME[=value] ...]: variables passed to commands, without arguments the exported ones are listed
+int builtinExport(int argc, char *const argv[]) {
+    int i, status = 0;
+    if (argc == 1) {
+        char **envp = varsEnvp();
+        for (i = 0; envp[i] != NULL; i++) printf("export %s\n", envp[i]);
+        return 0;
+    }
+    for (i = 1; i < argc; i++) {
+        if (strchr(argv[i], '=') != NULL) status |= varAssign(argv[i], 1);
+        else if (varNameLen(argv[i]) == 0 || argv[i][varNameLen(argv[i])] != '\0') {
+            fprintf(stderr, "export: %s: not a valid name\n", argv[i]);
+            status = 1;
+        } else if (varGet(argv[i]) != NULL) status |= varSet(argv[i], varGet(argv[i]), 1);
+        else status |= varSet(argv[i], "", 1);
+    }
+    return status;
+}
+
+// unset NAME ...
+int builtinUnset(int argc, char *const argv[]) {
+    int i;
+    for (i = 1; i < argc; i++) varUnset(argv[i]);
+    return 0;
+}
+
+// set: all variables (exported or not)
+int builtinSet(int argc, char *const argv[]) {
+    var_t *v;
+    int i;
+    (void)argc; (void)argv;
+    for (i = 0; i < SHELL_VARS_BUCKETS; i++)
+        for (v = shell_vars->buckets[i]; v != NULL; v = v->next) printf("%s\n", v->entry);
+    return 0;
+}
+
+// --------------------------------------
+// pathname expansion (glob)
+// --------------------------------------
+
+// directory entry as returned by getdents64 (man 2 getdents64)
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// cached listing of a directory, valid while the directory's mtime stays the same
+typedef struct glob_dir {
+    char *path;                         // as written in the pattern ("" for the working directory, else ending with '/')
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char racy;                          // read within the clock tick of mtime, a later change may keep the same mtime
+    char *names;                        // records of d_type followed by the '\0'-terminated name
+    int names_len;
+    int names_size;
+    struct glob_dir *next;              // most recently used first
+} glob_dir_t;
+
+// matches of a pattern
+typedef struct {
+    char **v;
+    int count;
+    int size;
+} glob_list_t;
+
+glob_dir_t *glob_dirs = NULL;
+int glob_dirs_count = 0;
+
+// length of the "[...]" class at the start of p (0 if it isn't one), (*match) is set if ch is in it
+int globClass(const char *p, unsigned char ch, char *match) {
+    int i = 1, negate = 0, found = 0;
+    if (p[i] == '!' || p[i] == '^') negate = i++;
+    for (int first = 1; p[i] != '\0' && (p[i] != ']' || first); first = 0) {
+        unsigned char lo, hi;
+        if (p[i] == '\\' && p[i + 1] != '\0') i++;
+        lo = hi = p[i++];
+        if (p[i] == '-' && p[i + 1] != '\0' && p[i + 1] != ']') {
+            i++;
+            if (p[i] == '\\' && p[i + 1] != '\0') i++;
+            hi = p[i++];
+        }
+        if (ch >= lo && ch <= hi) found = 1;
+    }
+    if (p[i] != ']') return 0;
+    (*match) = (found != negate);
+    return i + 1;
+}
+
+// name matches the pattern ('*', '?', "[...]", '\\' escapes the next character)
+char globMatch(const char *p, const char *name) {
+    const char *star_p = NULL;          // pattern after the last '*' and the name position it was tried at
+    const char *star_name = NULL;
+    int len;
+    char match;
+    while ((*name) != '\0') {
+        if ((*p) == '*') {
+            star_p = ++p;
+            star_name = name;
+            continue;
+        }
+        if ((*p) == '?') {
+            p++; name++;
+            continue;
+        }
+        if ((*p) == '[' && (len = globClass(p, (*name), &match)) > 0) {
+            if (match) {
+                p += len; name++;
+                continue;
+            }
+        } else {
+            if ((*p) == '\\' && p[1] != '\0') p++;
+            if ((*p) != '\0' && (*p) == (*name)) {
+                p++; name++;
+                continue;
+            }
+        }
+        if (star_p == NULL) return 0;
+        p = star_p;                     // let the last '*' take one more character
+        name = ++star_name;
+    }
+    while ((*p) == '*') p++;
+    return (*p) == '\0';
+}
+
+// the word has an unescaped '*', '?' or "[...]" (it is expanded)
+char globHasMeta(const char *word) {
+    char match;
+    for (; (*word) != '\0'; word++) {
+        if ((*word) == '\\' && word[1] != '\0') word++;
+        else if ((*word) == '*' || (*word) == '?') return 1;
+        else if ((*word) == '[' && globClass(word, 'x', &match) > 0) return 1;
+    }
+    return 0;
+}
+
+// remove the escapes of a word in place
+void globUnescape(char *word) {
+    char *to = word;
+    for (; (*word) != '\0'; word++) {
+        if ((*word) == '\\' && word[1] != '\0') word++;
+        (*to++) = (*word);
+    }
+    (*to) = '\0';
+}
+
+// forget the listings of relative paths (the working directory changed), all of them if all is set
+void globDirsClear(char all) {
+    glob_dir_t **at = &glob_dirs;
+    while ((*at) != NULL) {
+        glob_dir_t *d = (*at);
+        if (!all && d->path[0] == '/') {
+            at = &(d->next);
+            continue;
+        }
+        (*at) = d->next;
+        free(d->path);
+        free(d->names);
+        free(d);
+        glob_dirs_count--;
+    }
+}
+
+// read the directory into the listing with batched getdents64
+// returns 1 on error
+char globDirRead(glob_dir_t *d) {
+    static char *buffer = NULL;         // one batch of entries
+    long got, at;
+    int fd = open(d->path[0] ? d->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return 1;
+    if (buffer == NULL && (buffer = malloc(SHELL_GLOB_BUFFER)) == NULL) {
+        close(fd);
+        return 1;
+    }
+    d->names_len = 0;
+    while ((got = sc_getdents64(fd, buffer, SHELL_GLOB_BUFFER)) > 0) {
+        for (at = 0; at < got; at += ((struct linux_dirent64 *)(buffer + at))->d_reclen) {
+            struct linux_dirent64 *e = (struct linux_dirent64 *)(buffer + at);
+            int len = strlen(e->d_name);
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+            if (d->names_len + len + 2 > d->names_size) {
+                int size = d->names_size ? d->names_size * 2 : 4096;
+                while (d->names_len + len + 2 > size) size *= 2;
+                char *grown = realloc(d->names, size);
+                if (grown == NULL) {
+                    close(fd);
+                    return 1;
+                }
+                d->names = grown;
+                d->names_size = size;
+            }
+            d->names[d->names_len] = e->d_type;
+            memcpy(d->names + d->names_len + 1, e->d_name, len + 1);
+            d->names_len += len + 2;
+        }
+    }
+    close(fd);
+    return got == -1;
+}
+
+// listing of the directory (cached, read again once the directory's mtime changed)
+// returns NULL if it can't be read
+glob_dir_t *globDir(const char *path) {
+    struct stat st;
+    glob_dir_t **at, *d = NULL;
+    if (stat(path[0] ? path : ".", &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    for (at = &glob_dirs; (*at) != NULL; at = &((*at)->next)) {
+        if (strcmp((*at)->path, path) != 0) continue;
+        d = (*at);
+        (*at) = d->next;                // moved to the front below
+        glob_dirs_count--;
+        break;
+    }
+    if (d != NULL && !d->racy && d->dev == st.st_dev && d->ino == st.st_ino
+        && d->mtime.tv_sec == st.st_mtim.tv_sec && d->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        d->next = glob_dirs;
+        glob_dirs = d;
+        glob_dirs_count++;
+        return d;
+    }
+
+    // new or changed directory
+    if (d == NULL) {
+        if ((d = calloc(1, sizeof(glob_dir_t))) == NULL || (d->path = strdup(path)) == NULL) {
+            free(d);
+            return NULL;
+        }
+        if (glob_dirs_count >= SHELL_GLOB_DIRS) { // least recently used listing is dropped
+            for (at = &glob_dirs; (*at)->next != NULL; at = &((*at)->next));
+            free((*at)->path);
+            free((*at)->names);
+            free((*at));
+            (*at) = NULL;
+            glob_dirs_count--;
+        }
+    }
+    // mtime is taken before reading, a change during the read gets the directory read again next time
+    // (mtimes come from the coarse clock, a listing isn't trusted while its mtime is the current tick)
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->mtime = st.st_mtim;
+    d->racy = st.st_mtim.tv_sec > now.tv_sec || (st.st_mtim.tv_sec == now.tv_sec && st.st_mtim.tv_nsec >= now.tv_nsec);
+    if (globDirRead(d) != 0) {
+        free(d->path);
+        free(d->names);
+        free(d);
+        return NULL;
+    }
+    d->next = glob_dirs;
+    glob_dirs = d;
+    glob_dirs_count++;
+    return d;
+}
+
+// add a copy of the path to the matches
+// returns 1 on a memory allocation error
+char globAdd(glob_list_t *list, const char *path) {
+    if (list->count == list->size) {
+        int size = list->size ? list->size * 2 : 16;
+        char **grown = realloc(list->v, size * sizeof(char *));
+        if (grown == NULL) return 1;
+        list->v = grown;
+        list->size = size;
+    }
+    if ((list->v[list->count] = strdup(path)) == NULL) return 1;
+    list->count++;
+    return 0;
+}
+
+// match the pattern (rest of the whole pattern) in the directory path[0..len) ("" or ending with '/')
+void globWalk(const char *pattern, char *path, int len, glob_list_t *list) {
+    char comp[PATH_MAX];
+    struct stat st;
+    const char *slash = strchr(pattern, '/');
+    int comp_len = (slash != NULL) ? slash - pattern : (int)strlen(pattern);
+    if (comp_len >= PATH_MAX || len + comp_len + 2 > PATH_MAX) return;
+    memcpy(comp, pattern, comp_len);
+    comp[comp_len] = '\0';
+
+    // literal component: no listing needed
+    if (!globHasMeta(comp)) {
+        globUnescape(comp);
+        strcpy(path + len, comp);
+        len += strlen(comp);
+        if (slash == NULL) {
+            if (lstat(path, &st) == 0) globAdd(list, path);
+            return;
+        }
+        strcpy(path + len, "/");
+        if (slash[1] == '\0') {
+            if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) globAdd(list, path);
+        } else globWalk(slash + 1, path, len + 1, list);
+        return;
+    }
+
+    path[len] = '\0';
+    glob_dir_t *d = globDir(path);
+    if (d == NULL) return;
+    // listing of a deeper directory may replace this one, so it is walked over a copy
+    char *names = d->names;
+    int names_len = d->names_len;
+    if (slash != NULL && (names = malloc(names_len + 1)) == NULL) return;
+    if (slash != NULL) memcpy(names, d->names, names_len);
+
+    int at;
+    for (at = 0; at < names_len; at += strlen(names + at + 1) + 2) {
+        unsigned char type = names[at];
+        const char *name = names + at + 1;
+        int name_len = strlen(name);
+        if (name[0] == '.' && comp[0] != '.') continue; // hidden unless asked for
+        if (len + name_len + 2 > PATH_MAX || !globMatch(comp, name)) continue;
+        memcpy(path + len, name, name_len + 1);
+        if (slash == NULL) {
+            globAdd(list, path);
+            continue;
+        }
+        if (type != DT_DIR && type != DT_UNKNOWN && type != DT_LNK) continue;
+        if (type != DT_DIR && (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))) continue;
+        strcpy(path + len + name_len, "/");
+        if (slash[1] == '\0') globAdd(list, path);
+        else globWalk(slash + 1, path, len + name_len + 1, list);
+    }
+    if (slash != NULL) free(names);
+}
+
+int compareStrings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// paths matching the pattern, sorted (free them and list->v after use)
+// returns the number of matches
+int globExpand(const char *pattern, glob_list_t *list) {
+    char path[PATH_MAX];
+    memset(list, 0, sizeof(glob_list_t));
+    globWalk(pattern, path, 0, list);
+    qsort(list->v, list->count, sizeof(char *), compareStrings);
+    return list->count;
+}
+
+unsigned int shell_cwd_changes = 0; // successful cd count (the server saves the directory of the session)
+
+// set the current working directory
+// verifiable using external ls or pwd
+// returns 1 on error, 0 if no error
+char changedir(char* arg) {
+    // check for input and trim arg
+    // also if no input => cd to HOME directory
+    if (arg == NULL || (arg = trim(arg))[0] == '\0') {
+        if (prompt_stale) promptRefresh();
+        arg = prompt_cache.home; // resolved along with the prompt
+    }
+    // process the user input as a directory location
+    // printf("[%s]\n", arg);
+    if (chdir(arg) != 0) {
+        perror("cd error");
+        return 1;
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) varSet("PWD", cwd, 0);
+    globDirsClear(0); // relative listings belong to the previous directory
+    shell_cwd_changes++;
+    return 0;
+}
+
+// --------------------------------------
+// per-line arena
+// --------------------------------------
+
+// block of arena memory, allocations are bumped through data
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+// bump allocator for everything parsed from one input line, released at once with arenaReset
+typedef struct {
+    arena_block_t *head; // current block (older, full blocks follow)
+} arena_t;
+
+// allocate size bytes (pointer aligned) from the arena, NULL on malloc failure
+void *arenaAlloc(arena_t *arena, size_t size) {
+    arena_block_t *block = arena->head;
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (block == NULL || block->used + size > block->size) {
+        size_t block_size = (size > SHELL_ARENA_BLOCK) ? size : SHELL_ARENA_BLOCK;
+        if ((block = malloc(sizeof(arena_block_t) + block_size)) == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    block->used += size;
+    return block->data + block->used - size;
+}
+
+// release everything allocated from the arena, the current block is kept for the next line
+void arenaReset(arena_t *arena) {
+    if (arena->head == NULL) return;
+    while (arena->head->next != NULL) {
+        arena_block_t *block = arena->head->next;
+        arena->head->next = block->next;
+        free(block);
+    }
+    arena->head->used = 0;
+}
+
+// free all memory of the arena
+void arenaFree(arena_t *arena) {
+    arenaReset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+// --------------------------------------
+// command line parsing
+// --------------------------------------
+
+// a single command (stage of a pipeline)
+typedef struct cmd {
+    int argc;
+    int argv_size;          // capacity of argv (incl. the terminating NULL)
+    char **argv;            // NULL-terminated (requirement for exec)
+    char *redir_in;         // '<' file or NULL
+    char *redir_out;        // '>' file or NULL
+    int assigns_count;
+    int assigns_size;
+    char **assigns;         // "NAME=value" words before the command name, NULL-terminated (or NULL if none)
+    struct cmd *next;       // next stage ('|')
+} cmd_t;
+
+// commands connected with '|'
+typedef struct pipeline {
+    cmd_t *stages;
+    int count;
+    char background;        // ended by '&'
+    int text_start;         // pipeline in the input (job listing)
+    int text_end;
+    struct pipeline *next;  // next pipeline (';' or '&')
+} pipeline_t;
+
+// add a word to a NULL-terminated word list (grows by doubling inside the arena)
+char wordsAdd(arena_t *arena, char ***words, int *count, int *size, char *word) {
+    if ((*count) + 1 >= (*size)) {
+        int grown_size = (*size) ? (*size) * 2 : 8;
+        char **grown = arenaAlloc(arena, grown_size * sizeof(char *));
+        if (grown == NULL) return 1;
+        if ((*count) > 0) memcpy(grown, (*words), (*count) * sizeof(char *));
+        (*words) = grown;
+        (*size) = grown_size;
+    }
+    (*words)[(*count)++] = word;
+    (*words)[(*count)] = NULL;
+    return 0;
+}
+
+// add an argument to the command
+char cmdAddArg(arena_t *arena, cmd_t *cmd, char *arg) {
+    return wordsAdd(arena, &(cmd->argv), &(cmd->argc), &(cmd->argv_size), arg);
+}
+
+// value of the "$..." expansion at str ("$?", "$NAME" or "${NAME}"), (*len) is set to its length in the input
+// buffer holds the text of "$?", unset variables expand to ""
+// returns NULL if str isn't an expansion (a literal '$')
+const char *expandVar(const char *str, int *len, char *buffer, int size) {
+    const char *value;
+    char name[256];
+    int name_len;
+    if (str[1] == '?') {
+        snprintf(buffer, size, "%d", shell_status);
+        (*len) = 2;
+        return buffer;
+    }
+    if (str[1] == '{') {
+        name_len = varNameLen(str + 2);
+        if (name_len == 0 || str[2 + name_len] != '}') return NULL;
+        (*len) = name_len + 3;
+    } else {
+        if ((name_len = varNameLen(str + 1)) == 0) return NULL;
+        (*len) = name_len + 1;
+    }
+    if (name_len >= (int)sizeof(name)) return "";
+    memcpy(name, str + 1 + (str[1] == '{'), name_len);
+    name[name_len] = '\0';
+    return ((value = varGet(name)) != NULL) ? value : "";
+}
+
+// make room for need more bytes of the word being built, followed by rest bytes (for the rest of its text)
+// a word that doesn't fit is moved to a new block of the arena
+// returns 1 on a memory allocation error
+char wordReserve(arena_t *arena, char **word, char **op, char **op_end, int need, int rest) {
+    if ((*op) + need + rest + 1 <= (*op_end)) return 0;
+    int word_len = ((*word) != NULL) ? (*op) - (*word) : 0;
+    int size = word_len + need + rest + 1;
+    char *moved = arenaAlloc(arena, size);
+    if (moved == NULL) return 1;
+    if (word_len > 0) memcpy(moved, (*word), word_len);
+    if ((*word) != NULL) (*word) = moved;
+    (*op) = moved + word_len;
+    (*op_end) = moved + size;
+    return 0;
+}
+
+// add a finished argument word, a word with an unescaped '*', '?' or "[...]" is replaced by the paths
+// it matches (sorted), or kept as it is without them
+// quoted, escaped and expanded glob characters are marked with '\\' in the word (by wordExpand, removed here)
+// returns 1 on a memory allocation error
+char cmdAddWord(arena_t *arena, cmd_t *cmd, char *word) {
+    glob_list_t matches;
+    int i;
+    char r = 0;
+    if (!globHasMeta(word) || globExpand(word, &matches) == 0) {
+        globUnescape(word);
+        return cmdAddArg(arena, cmd, word);
+    }
+    for (i = 0; i < matches.count; i++) {
+        int len = strlen(matches.v[i]);
+        char *arg = (r == 0) ? arenaAlloc(arena, len + 1) : NULL;
+        if (arg == NULL) r = 1;
+        else {
+            memcpy(arg, matches.v[i], len + 1);
+            r = cmdAddArg(arena, cmd, arg);
+        }
+        free(matches.v[i]);
+    }
+    free(matches.v);
+    return r;
+}
+
+// parse a whole line of user input in a single pass into a sequence of pipelines
+// words, commands and pipelines are allocated in the arena (released with arenaReset)
+// words are kept as written (quotes, escapes and "$..." in them), pipelineExpand expands them once the pipeline runs,
+// "NAME=value" words before the command name become its assignments
+// returns the first pipeline, NULL if there is nothing to execute or on error ((*error) set to 1)
+pipeline_t *parseLine(arena_t *arena, const char *input, char *error) {
+    pipeline_t *first = NULL;       // result
+    pipeline_t *pipeline = NULL;    // pipeline being built
+    pipeline_t **pipeline_end = &first;
+    cmd_t *cmd = NULL;              // command being built
+    cmd_t **cmd_end = NULL;
+    char *op;                       // output position for word characters
+    char *word = NULL;              // word being built
+    char quote = 0;
+    char escaped = 0;
+    char redirected = 0;            // '<' or '>' waiting for its file name
+    char piped = 0;                 // '|' waiting for its command
+    const char *text = NULL;        // start of the pipeline being built in the input
+    const char *ip;
+
+    (*error) = 1;
+    // words are never longer than the input, all of them fit behind each other (with their '\0')
+    if ((op = arenaAlloc(arena, strlen(input) + 1)) == NULL) return NULL;
+
+    for (ip = input; ; ip++) {
+        char ch = (*ip);
+
+        if (text == NULL && strchr(" \t\n;&", ch) == NULL) text = ip;
+        if (ch != '\0') {
+            char special = 0;                           // '\\' and quotes stay in the word (see wordExpand)
+            if (escaped) escaped = 0;                   // literal treatment of any escaped character
+            else if (ch == '\\') escaped = 1;           // escaped character starts a word
+            else if (ch == '\"') quote = !quote;        // quotes start a word (even an empty one)
+            else if (!quote) special = strchr(" \t\n;&|<>#", ch) != NULL; // everything between quotes is literal
+
+            if (!special) {
+                if (word == NULL) word = op;
+                (*op++) = ch;
+                continue;
+            }
+        } else if (quote) {
+            fprintf(stderr, "Matching quote not found.\n");
+            return NULL;
+        }
+
+        // special character (or end of input) ends the word being built
+        if (word != NULL) {
+            (*op++) = '\0';
+            if (cmd == NULL) {
+                if ((cmd = arenaAlloc(arena, sizeof(cmd_t))) == NULL) return NULL;
+                memset(cmd, 0, sizeof(cmd_t));
+            }
+            int name_len = varNameLen(word);    // the name and '=' are neither quoted, escaped nor expanded
+            char assign = !redirected && cmd->argc == 0 && name_len > 0 && word[name_len] == '=';
+            if (redirected == '<') cmd->redir_in = word;
+            else if (redirected == '>') cmd->redir_out = word;
+            else if (assign) {
+                if (wordsAdd(arena, &(cmd->assigns), &(cmd->assigns_count), &(cmd->assigns_size), word) != 0) return NULL;
+            } else if (cmdAddArg(arena, cmd, word) != 0) return NULL;
+            redirected = 0;
+            word = NULL;
+        }
+
+        if (ch == ' ' || ch == '\t' || ch == '\n') continue;
+        if (redirected) {
+            fprintf(stderr, "No file name after redirection.\n");
+            return NULL;
+        }
+        if (ch == '<' || ch == '>') {
+            redirected = ch;
+            continue;
+        }
+
+        // command ends ('|', ';', '&', '#' or end of input)
+        if (cmd != NULL) {
+            if (cmd->argv == NULL && cmdAddArg(arena, cmd, NULL) != 0) return NULL; // argv of a command without arguments
+            cmd->argc = (cmd->argv[0] == NULL) ? 0 : cmd->argc;
+            if (pipeline == NULL) {
+                if ((pipeline = arenaAlloc(arena, sizeof(pipeline_t))) == NULL) return NULL;
+                memset(pipeline, 0, sizeof(pipeline_t));
+                cmd_end = &(pipeline->stages);
+            }
+            (*cmd_end) = cmd;
+            cmd_end = &(cmd->next);
+            pipeline->count++;
+            cmd = NULL;
+            piped = 0;
+        } else if (ch == '|' || piped) {
+            fprintf(stderr, (ch == '|') ? "No command before pipe.\n" : "No command after pipe.\n");
+            return NULL;
+        }
+        if (ch == '|') {
+            piped = 1;
+            continue;
+        }
+
+        // pipeline ends (';', '&', '#' or end of input)
+        if (pipeline != NULL) {
+            pipeline->background = (ch == '&');
+            pipeline->text_start = text - input;
+            pipeline->text_end = ip - input;
+            while (pipeline->text_end > pipeline->text_start && strchr(" \t\n", input[pipeline->text_end - 1]) != NULL)
+                pipeline->text_end--;
+            (*pipeline_end) = pipeline;
+            pipeline_end = &(pipeline->next);
+            pipeline = NULL;
+        } else if (ch == '&') {
+            fprintf(stderr, "No command before '&'.\n");
+            return NULL;
+        }
+        text = NULL;
+        if (ch == ';' || ch == '&') continue;
+        break; // rest of the input is a comment or there is no input left
+    }
+
+    (*error) = 0;
+    return first;
+}
+
+// expand a word as parseLine keeps it: quotes and '\\' escapes are removed, "$NAME", "${NAME}" and "$?" are replaced
+// by their values (also between quotes, the value is never split), quoted, escaped and expanded glob characters
+// and '\\' are marked with '\\' in the result (see cmdAddWord)
+// (*expanded) is set to NULL if the word is only made of empty expansions outside quotes (it is no word then)
+// returns 1 on a memory allocation error
+char wordExpand(arena_t *arena, const char *text, char **expanded) {
+    char status[16];                // text of "$?"
+    const char *text_end = text + strlen(text);
+    const char *ip;
+    char *word, *op, *op_end;
+    char quote = 0;
+    char found = 0;                 // there is a word
+
+    (*expanded) = NULL;
+    // the word fits twice its text (every character marked) until an expansion makes it longer, see wordReserve
+    if ((word = op = arenaAlloc(arena, 2 * (text_end - text) + 1)) == NULL) return 1;
+    op_end = op + 2 * (text_end - text) + 1;
+
+    for (ip = text; (*ip) != '\0'; ip++) {
+        const char *value = ip;     // characters added to the word
+        int len = 1, value_len = 1, i;
+        char marked = quote;        // glob characters in value are literal
+        if ((*ip) == '\"') {
+            quote = !quote;
+            found = 1;
+            continue;
+        }
+        if ((*ip) == '\\') {
+            found = 1;
+            if (ip[1] == '\0') break;  // escaped end of the input
+            value = ++ip;
+            marked = 1;
+        } else if ((*ip) == '$' && (value = expandVar(ip, &len, status, sizeof(status))) != NULL) {
+            value_len = strlen(value);
+            marked = 1;             // values aren't globbed
+        } else value = ip;          // literal '$' or any other character
+        if (wordReserve(arena, &word, &op, &op_end, 2 * value_len, 2 * (text_end - (ip + len))) != 0) return 1;
+        for (i = 0; i < value_len; i++) {
+            if (marked && strchr("*?[\\", value[i]) != NULL) (*op++) = '\\';
+            (*op++) = value[i];
+        }
+        found |= value_len > 0;
+        ip += len - 1;
+    }
+    (*op) = '\0';
+    if (found) (*expanded) = word;
+    return 0;
+}
+
+// expanded file name of a redirection or value of an assignment (not globbed)
+// returns NULL on a memory allocation error
+char *wordExpandPlain(arena_t *arena, const char *text) {
+    char *word;
+    if (wordExpand(arena, text, &word) != 0) return NULL;
+    if (word == NULL) return "";
+    globUnescape(word);
+    return word;
+}
+
+// expand the words of every stage of the pipeline right before it runs, so they see the variables, "$?"
+// and the files (and working directory) the pipelines before it left
+// an argument with an unquoted '*', '?' or "[...]" is replaced by the paths it matches (see cmdAddWord)
+// returns 1 on a memory allocation error
+char pipelineExpand(arena_t *arena, pipeline_t *pipeline) {
+    cmd_t *cmd;
+    for (cmd = pipeline->stages; cmd != NULL; cmd = cmd->next) {
+        char **words = cmd->argv;
+        int count = cmd->argc, i;
+        char *word;
+        if (cmd->redir_in != NULL && (cmd->redir_in = wordExpandPlain(arena, cmd->redir_in)) == NULL) return 1;
+        if (cmd->redir_out != NULL && (cmd->redir_out = wordExpandPlain(arena, cmd->redir_out)) == NULL) return 1;
+        for (i = 0; i < cmd->assigns_count; i++)
+            if ((cmd->assigns[i] = wordExpandPlain(arena, cmd->assigns[i])) == NULL) return 1;
+        cmd->argv = NULL;
+        cmd->argc = cmd->argv_size = 0;
+        for (i = 0; i < count; i++) {
+            if (wordExpand(arena, words[i], &word) != 0) return 1;
+            if (word != NULL && cmdAddWord(arena, cmd, word) != 0) return 1;
+        }
+        if (cmd->argv == NULL && cmdAddArg(arena, cmd, NULL) != 0) return 1; // argv of a command without arguments
+        cmd->argc = (cmd->argv[0] == NULL) ? 0 : cmd->argc;
+    }
+    return 0;
+}
+
+// --------------------------------------
+// command lookup cache (as "hash" in bash)
+// --------------------------------------
+
+// remembered location of a command found in PATH
+typedef struct hash_entry {
+    char *name;
+    char *path;
+    unsigned int hits;
+    struct hash_entry *next;
+} hash_entry_t;
+
+hash_entry_t *cmd_hash[SHELL_HASH_BUCKETS];
+char *cmd_hash_env = NULL; // PATH the remembered locations were found in
+
+// forget all remembered command locations
+void hashClear() {
+    int i;
+    for (i = 0; i < SHELL_HASH_BUCKETS; i++) {
+        while (cmd_hash[i] != NULL) {
+            hash_entry_t *e = cmd_hash[i];
+            cmd_hash[i] = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+}
+
+// check for an executable regular file
+char isExecutable(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// search PATH for the command name, returns a malloc'd absolute path or NULL if not found
+char *searchPath(const char *name, const char *env) {
+    int name_len = strlen(name);
+    while (env != NULL) {
+        const char *end = strchr(env, ':');
+        int dir_len = (end == NULL) ? (int)strlen(env) : (int)(end - env);
+        char *path = malloc(dir_len + name_len + 3);
+        if (path == NULL) return NULL;
+        if (dir_len == 0) strcpy(path, "."); // empty PATH entry = current directory
+        else {
+            memcpy(path, env, dir_len);
+            path[dir_len] = '\0';
+        }
+        strcat(path, "/");
+        strcat(path, name);
+        if (isExecutable(path)) return path;
+        free(path);
+        env = (end == NULL) ? NULL : end + 1;
+    }
+    return NULL;
+}
+
+// location of the command name to be executed, resolved through PATH only on the first use
+// names containing '/' are not looked up, NULL is returned for them and for commands not found
+// the cache resets itself when PATH changes, a remembered location that no longer exists is searched again
+const char *hashLookup(const char *name) {
+    const char *env = varGet("PATH");
+    hash_entry_t **ep, *e;
+    if (strchr(name, '/') != NULL || name[0] == '\0') return NULL;
+
+    if (env == NULL) env = "";
+    if (cmd_hash_env == NULL || strcmp(cmd_hash_env, env) != 0) {
+        hashClear();
+        free(cmd_hash_env);
+        cmd_hash_env = strdup(env);
+    }
+
+    ep = &(cmd_hash[hashString(name, strlen(name)) % SHELL_HASH_BUCKETS]);
+    for (e = (*ep); e != NULL; ep = &(e->next), e = e->next) {
+        if (strcmp(e->name, name) != 0) continue;
+        if (access(e->path, X_OK) == 0) {
+            e->hits++;
+            return e->path;
+        }
+        // stale location
+        (*ep) = e->next;
+        free(e->name);
+        free(e->path);
+        free(e);
+        break;
+    }
+
+    e = malloc(sizeof(hash_entry_t));
+    if (e == NULL) return NULL;
+    if ((e->path = searchPath(name, env)) == NULL || (e->name = strdup(name)) == NULL) {
+        free(e->path);
+        free(e);
+        return NULL;
+    }
+    e->hits = 1;
+    ep = &(cmd_hash[hashString(name, strlen(name)) % SHELL_HASH_BUCKETS]);
+    e->next = (*ep);
+    (*ep) = e;
+    return e->path;
+}
+
+// hash [-r] [name ...]: no argument lists remembered locations, -r forgets them, names are looked up and remembered
+int builtinHash(int argc, char *const argv[]) {
+    hash_entry_t *e;
+    int i;
+    int status = 0;
+    if (argc < 2) {
+        printf("hits\tcommand\n");
+        for (i = 0; i < SHELL_HASH_BUCKETS; i++)
+            for (e = cmd_hash[i]; e != NULL; e = e->next)
+                printf("%4u\t%s\n", e->hits, e->path);
+        return 0;
+    }
+    if (strcmp(argv[1], "-r") == 0) {
+        hashClear();
+        return 0;
+    }
+    for (i = 1; i < argc; i++) {
+        if (hashLookup(argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// handle child process behavior after successful forking
+// path is the resolved location of the command (execvpe searches PATH if NULL), envp its environment
+// builtin (if not NULL) runs in the child instead of the command, its result is the exit status
+void handleChild(const char *path, char *const args[], int argc, char *const envp[],
+                 char *redir_in, char *redir_out, 
+                 char is_pipe, 
+                 int *pipe_left_read, int *pipe_left_write, 
+                 int *pipe_right_read, int *pipe_right_write,
+                 int (*builtin)(int, char *const[])) {
+                     
+    if (argc == 0) return;
+
+    // printf("[child]\n");
+
+    // open file-redirected input and output files each exists
+    // replace STDIN/STDOUT streams with these files
+    // otherwise if PIPES found, replace STDIN/STDOUT streams with PIPE_READ/PIPE_WRITE
+    if (redir_in != NULL) {
+        int in_fd = open(redir_in, O_RDONLY);
+        if (in_fd < 0) {
+            perror("Failed to open input file");
+            return;
+        }
+        if (sc_dup3(in_fd, STDIN_FILENO, 0) == -1) {
+            perror("Failed to redirect STDIN to input file");
+            return;
+        }
+        close(in_fd);
+    } else if (is_pipe == IS_PIPE_LEFT || is_pipe == IS_PIPE_BOTH) { // only read from left
+        close((*pipe_left_write)); (*pipe_left_write) = -1;
+        if (sc_dup3((*pipe_left_read), STDIN_FILENO, 0) == -1) {
+            perror("Failed to redirect STDIN to the read end of the left pipe");
+            return;
+        }
+        close((*pipe_left_read)); (*pipe_left_read) = -1;
+    }
+
+    if (redir_out != NULL) {
+        int out_fd = open(redir_out, O_WRONLY | O_CREAT, 0644);
+        if (out_fd < 0) {
+            perror("Failed to open output file");
+            return;
+        }
+        if (sc_dup3(out_fd, STDOUT_FILENO, 0) == -1) {
+            perror("Failed to redirect STDOUT to output file");
+            return;
+        }
+        close(out_fd);
+    } else if (is_pipe == IS_PIPE_RIGHT || is_pipe == IS_PIPE_BOTH) { // only write to right
+        close((*pipe_right_read)); (*pipe_right_read) = -1;
+        if (sc_dup3((*pipe_right_write), STDOUT_FILENO, 0) == -1) {
+            perror("Failed to redirect STDOUT to the write end of the right pipe");
+            return;
+        }
+        close((*pipe_right_write)); (*pipe_right_write) = -1;
+    }
+
+    if (builtin != NULL) {
+        // descriptors of the shell (other jobs' pipes on the server) aren't closed by an exec here
+        close_range(3, ~0U, 0);
+        int status = builtin(argc, args);
+        fflush(stdout);
+        _exit(status);
+    }
+
+    // man 3 exec
+    if (path != NULL) sc_execve(path, args, envp); // location already known, no PATH walk
+    else execvpe(args[0], args, envp);
+    perror("Failed to execute.");
+}
+
+// start a command stage without forking the shell (posix_spawn is vfork-like, no page tables are copied)
+// redirections and pipe ends become file actions of the spawned process, shell-internal fds are close-on-exec
+// returns the pid, -1 if the command couldn't be spawned (the caller falls back to fork + handleChild)
+pid_t spawnStage(const char *path, char *const args[], char *const envp[],
+                 char *redir_in, char *redir_out,
+                 char is_pipe, int pipe_left_read, int pipe_right_write,
+                 int out_fd, int err_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int err;
+
+    if (posix_spawn_file_actions_init(&actions) != 0) return -1;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    // output of server-side jobs
+    if (out_fd != -1) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    if (err_fd != -1) posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+
+    // file redirections take precedence over pipes (same as in handleChild)
+    if (redir_in != NULL) posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, redir_in, O_RDONLY, 0);
+    else if (is_pipe == IS_PIPE_LEFT || is_pipe == IS_PIPE_BOTH) posix_spawn_file_actions_adddup2(&actions, pipe_left_read, STDIN_FILENO);
+    if (redir_out != NULL) posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, redir_out, O_WRONLY | O_CREAT, 0644);
+    else if (is_pipe == IS_PIPE_RIGHT || is_pipe == IS_PIPE_BOTH) posix_spawn_file_actions_adddup2(&actions, pipe_right_write, STDOUT_FILENO);
+
+    // the shell may have blocked signals for its own use (SIGCHLD on the server)
+    posix_spawnattr_setsigmask(&attr, &shell_sigmask_child);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_USEVFORK);
+
+    // man 3 posix_spawn
+    err = posix_spawn(&pid, path, &actions, &attr, args, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return (err == 0) ? pid : -1;
+}
+
+// --------------------------------------
+// parallel (runs as a forked pipeline stage)
+// --------------------------------------
+
+// job slot of parallel
+typedef struct {
+    pid_t pid;                          // running job, -1 if the slot is free
+    int out;                            // memfd collecting the STDOUT of the job
+    int err;                            // memfd collecting the STDERR of the job
+    int cpu;                            // CPU the slot is pinned to (-a), -1 if not pinned
+} parallel_slot_t;
+
+// write the output a job collected in the memfd to fd (in one piece) and empty the memfd
+void parallelFlush(int from, int to) {
+    struct stat st;
+    off_t offset = 0;
+    char buffer[SHELL_USERINPUT_MAX];
+    ssize_t r;
+    if (fstat(from, &st) == 0 && st.st_size > 0) {
+        while (offset < st.st_size && sendfile(to, from, &offset, st.st_size - offset) > 0);
+        // sendfile is refused by some outputs, copy the rest through a buffer
+        while (offset < st.st_size && (r = pread(from, buffer, sizeof(buffer), offset)) > 0) {
+            if (write(to, buffer, r) != r) break;
+            offset += r;
+        }
+    }
+    if (ftruncate(from, 0) != 0) perror("parallel");
+    lseek(from, 0, SEEK_SET);
+}
+
+// argv of a job: the template with every "{}" replaced by arg (arg is appended if the template has no "{}")
+// returns NULL on a memory allocation error
+char **parallelArgs(char *const tmpl[], int count, const char *arg) {
+    char **args = calloc(count + 2, sizeof(char *));
+    int i, used = 0, arg_len = strlen(arg);
+    const char *at, *from;
+    if (args == NULL) return NULL;
+    for (i = 0; i < count; i++) {
+        int marks = 0;
+        for (at = strstr(tmpl[i], "{}"); at != NULL; at = strstr(at + 2, "{}")) marks++;
+        if ((args[i] = malloc(strlen(tmpl[i]) + marks * arg_len + 1)) == NULL) break;
+        char *to = args[i];
+        for (from = tmpl[i]; (at = strstr(from, "{}")) != NULL; from = at + 2) {
+            memcpy(to, from, at - from); to += at - from;
+            memcpy(to, arg, arg_len); to += arg_len;
+        }
+        strcpy(to, from);
+        used += marks;
+    }
+    if (i == count && used == 0) args[i] = strdup(arg);
+    if (i < count || (used == 0 && args[i] == NULL)) {
+        for (i = 0; args[i] != NULL; i++) free(args[i]);
+        free(args);
+        return NULL;
+    }
+    return args;
+}
+
+// next argument of parallel: from the list after ":::", else a line of STDIN
+// returns NULL once there are no more
+char *parallelNext(char *const **list, int *list_count, char **line, size_t *line_size) {
+    ssize_t len;
+    if ((*list) != NULL) {
+        if ((*list_count) == 0) return NULL;
+        (*list_count)--;
+        return *((*list)++);
+    }
+    if ((len = getline(line, line_size, stdin)) == -1) return NULL;
+    if (len > 0 && (*line)[len - 1] == '\n') (*line)[len - 1] = '\0';
+    return (*line);
+}
+
+// parallel [-j N] [-a] cmd [args] [::: arg ...]
+// runs cmd once per argument with at most N (default: online CPUs) jobs at once
+// every job's STDOUT and STDERR are collected and written in one piece once it ends (no interleaved lines)
+// -a pins every job slot to a CPU of its own (round-robin over the allowed CPUs)
+// returns the number of failed jobs (at most 101, 0 if all succeeded), 255 on a usage error
+int parallelRun(int argc, char *const args[]) {
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    char pin = 0;
+    int i, tmpl_start, tmpl_count, running = 0, failed = 0;
+    char *const *list = NULL;
+    int list_count = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    char *arg;
+    cpu_set_t allowed;
+
+    for (i = 1; i < argc && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-j") == 0 && i + 1 < argc) jobs = atoi(args[++i]);
+        else if (strncmp(args[i], "-j", 2) == 0 && args[i][2] != '\0') jobs = atoi(args[i] + 2);
+        else if (strcmp(args[i], "-a") == 0) pin = 1;
+        else break;
+    }
+    tmpl_start = i;
+    for (; i < argc && strcmp(args[i], ":::") != 0; i++);
+    tmpl_count = i - tmpl_start;
+    if (i < argc) {
+        list = args + i + 1;
+        list_count = argc - i - 1;
+    }
+    if (tmpl_count == 0 || jobs < 1) {
+        fprintf(stderr, "Usage: parallel [-j N] [-a] cmd [args] [::: arg ...]\n");
+        return 255;
+    }
+
+    // slots with their output collectors, pinned slots get the allowed CPUs in turn
+    parallel_slot_t *slots = calloc(jobs, sizeof(parallel_slot_t));
+    if (slots == NULL) {
+        fprintf(stderr, "Memory allocation error.\n");
+        return 255;
+    }
+    if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        perror("parallel affinity");
+        pin = 0;
+    }
+    int cpu = -1;
+    for (i = 0; i < jobs; i++) {
+        slots[i].pid = -1;
+        slots[i].cpu = -1;
+        slots[i].out = slots[i].err = -1;
+    }
+    for (i = 0; i < jobs; i++) {
+        if (pin) {
+            do cpu = (cpu + 1) % CPU_SETSIZE; while (!CPU_ISSET(cpu, &allowed));
+            slots[i].cpu = cpu;
+        }
+        if ((slots[i].out = memfd_create("parallel-out", MFD_CLOEXEC)) == -1
+            || (slots[i].err = memfd_create("parallel-err", MFD_CLOEXEC)) == -1) {
+            perror("parallel");
+            failed = 255; // nothing has been started yet
+            goto cleanup;
+        }
+    }
+
+    while (1 == 1) {
+        // fill the free slots
+        for (i = 0; i < jobs && slots[i].pid != -1; i++);
+        while (i < jobs && (arg = parallelNext(&list, &list_count, &line, &line_size)) != NULL) {
+            char **job_args = parallelArgs(args + tmpl_start, tmpl_count, arg);
+            const char *path = (job_args != NULL) ? hashLookup(job_args[0]) : NULL;
+            if (job_args != NULL && (path != NULL || strchr(job_args[0], '/') != NULL)) {
+                // the spawned job inherits the affinity of the shell, which is restored right after
+                cpu_set_t one;
+                if (slots[i].cpu != -1) {
+                    CPU_ZERO(&one);
+                    CPU_SET(slots[i].cpu, &one);
+                    sched_setaffinity(0, sizeof(one), &one);
+                }
+                // STDIN of the jobs is /dev/null, parallelNext may be reading the arguments from it
+                slots[i].pid = spawnStage((path != NULL) ? path : job_args[0], job_args, varsEnvp(), "/dev/null", NULL,
+                                          IS_PIPE_NONE, -1, -1, slots[i].out, slots[i].err);
+                if (slots[i].cpu != -1) sched_setaffinity(0, sizeof(allowed), &allowed);
+            }
+            if (slots[i].pid == -1) {
+                fprintf(stderr, "%s: command not found\n", (job_args != NULL) ? job_args[0] : arg);
+                failed++;
+            } else running++;
+            if (job_args != NULL) {
+                for (int j = 0; job_args[j] != NULL; j++) free(job_args[j]);
+                free(job_args);
+            }
+            for (; i < jobs && slots[i].pid != -1; i++);
+        }
+        if (running == 0) break;
+
+        // a job ended: its output goes out in one piece and the slot is free again
+        int wstatus;
+        pid_t pid = sc_wait4(-1, &wstatus, 0, NULL);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            perror("parallel");
+            break;
+        }
+        for (i = 0; i < jobs && slots[i].pid != pid; i++);
+        if (i == jobs) continue;
+        slots[i].pid = -1;
+        running--;
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) failed++;
+        fflush(stdout);
+        parallelFlush(slots[i].out, STDOUT_FILENO);
+        parallelFlush(slots[i].err, STDERR_FILENO);
+    }
+
+    if (failed > 101) failed = 101;
+    cleanup:
+    for (i = 0; i < jobs; i++) {
+        if (slots[i].out != -1) close(slots[i].out);
+        if (slots[i].err != -1) close(slots[i].err);
+    }
+    free(slots);
+    free(line);
+    return failed;
+}
+
+// --------------------------------------
+// argv builtins (any stage of a pipeline)
+// --------------------------------------
+
+// cd [dir] (home without dir)
+int builtinCd(int argc, char *const argv[]) {
+    return changedir((argc > 1) ? argv[1] : NULL);
+}
+
+// echo [-n] [args]
+int builtinEcho(int argc, char *const argv[]) {
+    int i = 1;
+    char newline = 1;
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    for (; i < argc; i++) {
+        fputs(argv[i], stdout);
+        if (i + 1 < argc) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+// pwd
+int builtinPwd(int argc, char *const argv[]) {
+    char cwd[PATH_MAX];
+    (void)argc; (void)argv;
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    puts(cwd);
+    return 0;
+}
+
+// help
+int builtinHelp(int argc, char *const argv[]) {
+    (void)argc; (void)argv;
+    printf("%s\n", help);
+    return 0;
+}
+
+int builtinTrue(int argc, char *const argv[]) {
+    (void)argc; (void)argv;
+    return 0;
+}
+
+int builtinFalse(int argc, char *const argv[]) {
+    (void)argc; (void)argv;
+    return 1;
+}
+
+// print a backslash escape of printf starting at s (behind the '\'), returns the characters consumed
+int printfEscape(const char *s) {
+    const char *from = "abfnrtv\\";
+    const char *to = "\a\b\f\n\r\t\v\\";
+    const char *at = ((*s) != '\0') ? strchr(from, (*s)) : NULL;
+    if (at != NULL) {
+        putchar(to[at - from]);
+        return 1;
+    }
+    if ((*s) >= '0' && (*s) <= '7') { // octal, up to 3 digits
+        int value = 0, n = 0;
+        while (n < 3 && s[n] >= '0' && s[n] <= '7') value = value * 8 + (s[n++] - '0');
+        putchar(value);
+        return n;
+    }
+    putchar('\\');
+    return 0;
+}
+
+// printf format [args]: %s %b %c %d %i %u %o %x %X %% with flags, width and precision, backslash escapes
+// the format is reused while arguments are left (as in POSIX printf)
+int builtinPrintf(int argc, char *const argv[]) {
+    int next = 2;
+    int status = 0;
+    if (argc < 2) {
+        fprintf(stderr, "Usage: printf format [args]\n");
+        return 1;
+    }
+    do {
+        const char *f = argv[1];
+        int consumed = next;
+        while ((*f) != '\0') {
+            if ((*f) == '\\') {
+                f += 1 + printfEscape(f + 1);
+                continue;
+            }
+            if ((*f) != '%') {
+                putchar(*f++);
+                continue;
+            }
+            if (f[1] == '%') {
+                putchar('%');
+                f += 2;
+                continue;
+            }
+            // conversion: the spec is handed to printf with the converted argument
+            char spec[32];
+            int len = strspn(f + 1, "-+ #0123456789.");
+            char conv = f[1 + len];
+            if (conv == '\0' || strchr("sbcdiuoxX", conv) == NULL || len + 6 > (int)sizeof(spec)) {
+                fprintf(stderr, "printf: invalid format\n");
+                return 1;
+            }
+            const char *arg = (next < argc) ? argv[next++] : "";
+            memcpy(spec, f, len + 1);
+            if (conv == 'd' || conv == 'i') {
+                char *end;
+                errno = 0;
+                long long value = strtoll(arg, &end, 0);
+                if ((*arg) != '\0' && ((*end) != '\0' || errno != 0)) {
+                    fprintf(stderr, "printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                strcpy(spec + len + 1, "lld");
+                printf(spec, value);
+            } else if (strchr("uoxX", conv) != NULL) {
+                char *end;
+                errno = 0;
+                unsigned long long value = strtoull(arg, &end, 0);
+                if ((*arg) != '\0' && ((*end) != '\0' || errno != 0)) {
+                    fprintf(stderr, "printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                spec[len + 1] = 'l'; spec[len + 2] = 'l'; spec[len + 3] = conv; spec[len + 4] = '\0';
+                printf(spec, value);
+            } else if (conv == 'c') {
+                strcpy(spec + len + 1, "c");
+                printf(spec, (*arg));
+            } else if (conv == 'b') { // argument with backslash escapes
+                while ((*arg) != '\0') {
+                    if ((*arg) == '\\') arg += 1 + printfEscape(arg + 1);
+                    else putchar(*arg++);
+                }
+            } else {
+                strcpy(spec + len + 1, "s");
+                printf(spec, arg);
+            }
+            f += len + 2;
+        }
+        if (next == consumed) break; // no conversion took an argument, don't repeat forever
+    } while (next < argc);
+    return status;
+}
+
+// evaluate a test expression of argc words (POSIX rules for up to 4 arguments)
+// returns 0 if true, 1 if false, 2 on a syntax error
+int testEval(int argc, char *const argv[]) {
+    struct stat st;
+    if (argc == 0) return 1;
+    if (argc == 1) return argv[0][0] == '\0';
+    if (argc == 2) {
+        const char *op = argv[0], *arg = argv[1];
+        if (strcmp(op, "!") == 0) return !testEval(1, argv + 1);
+        if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') return 2;
+        switch (op[1]) {
+            case 'n': return arg[0] == '\0';
+            case 'z': return arg[0] != '\0';
+            case 'e': return stat(arg, &st) != 0;
+            case 'f': return stat(arg, &st) != 0 || !S_ISREG(st.st_mode);
+            case 'd': return stat(arg, &st) != 0 || !S_ISDIR(st.st_mode);
+            case 's': return stat(arg, &st) != 0 || st.st_size == 0;
+            case 'h':
+            case 'L': return lstat(arg, &st) != 0 || !S_ISLNK(st.st_mode);
+            case 'p': return stat(arg, &st) != 0 || !S_ISFIFO(st.st_mode);
+            case 'r': return access(arg, R_OK) != 0;
+            case 'w': return access(arg, W_OK) != 0;
+            case 'x': return access(arg, X_OK) != 0;
+        }
+        return 2;
+    }
+    if (argc == 3) {
+        const char *a = argv[0], *op = argv[1], *b = argv[2];
+        if (strcmp(op, "=") == 0) return strcmp(a, b) != 0;
+        if (strcmp(op, "!=") == 0) return strcmp(a, b) == 0;
+        static const char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (int i = 0; i < 6; i++) {
+            if (strcmp(op, ops[i]) != 0) continue;
+            char *end_a, *end_b;
+            long long x = strtoll(a, &end_a, 10), y = strtoll(b, &end_b, 10);
+            if ((*a) == '\0' || (*end_a) != '\0' || (*b) == '\0' || (*end_b) != '\0') {
+                fprintf(stderr, "test: integer expression expected\n");
+                return 2;
+            }
+            char r[] = {x == y, x != y, x < y, x <= y, x > y, x >= y};
+            return !r[i];
+        }
+        if (strcmp(a, "!") == 0) {
+            int r = testEval(2, argv + 1);
+            return (r == 2) ? 2 : !r;
+        }
+        if (strcmp(a, "(") == 0 && strcmp(b, ")") == 0) return testEval(1, argv + 1);
+        return 2;
+    }
+    if (argc == 4 && strcmp(argv[0], "!") == 0) {
+        int r = testEval(3, argv + 1);
+        return (r == 2) ? 2 : !r;
+    }
+    return 2;
+}
+
+// test expr, [ expr ]
+int builtinTest(int argc, char *const argv[]) {
+    int r;
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+    if ((r = testEval(argc - 1, argv + 1)) == 2 && argc - 1 <= 4) fprintf(stderr, "%s: syntax error\n", argv[0]);
+    else if (r == 2) fprintf(stderr, "%s: too many arguments\n", argv[0]);
+    return r;
+}
+
+// where a builtin runs
+#define BUILTIN_FORKED 0    // always in a forked stage (it waits for children of its own)
+#define BUILTIN_SHELL 1     // in the shell process when it is the whole pipeline (LOCAL and SERVER), forked inside a '|' chain
+
+typedef struct {
+    const char *name;
+    int (*run)(int argc, char *const argv[]); // exit status
+    char where;
+} builtin_t;
+
+// builtins on the state of the shell (defined along with it)
+int builtinHistory(int argc, char *const argv[]);
+int builtinJobs(int argc, char *const argv[]);
+int builtinWait(int argc, char *const argv[]);
+int builtinFg(int argc, char *const argv[]);
+int builtinKill(int argc, char *const argv[]);
+int builtinStats(int argc, char *const argv[]);
+
+// builtins on the parsed argv, found for any stage of a pipeline before PATH is searched
+// a forked builtin stage reads and writes the pipes like a command (handleChild), without an exec
+const builtin_t builtins[] = {
+    {"cd", builtinCd, BUILTIN_SHELL},
+    {"export", builtinExport, BUILTIN_SHELL},
+    {"unset", builtinUnset, BUILTIN_SHELL},
+    {"set", builtinSet, BUILTIN_SHELL},
+    {"echo", builtinEcho, BUILTIN_SHELL},
+    {"pwd", builtinPwd, BUILTIN_SHELL},
+    {"true", builtinTrue, BUILTIN_SHELL},
+    {"false", builtinFalse, BUILTIN_SHELL},
+    {":", builtinTrue, BUILTIN_SHELL},
+    {"printf", builtinPrintf, BUILTIN_SHELL},
+    {"test", builtinTest, BUILTIN_SHELL},
+    {"[", builtinTest, BUILTIN_SHELL},
+    {"help", builtinHelp, BUILTIN_SHELL},
+    {"history", builtinHistory, BUILTIN_SHELL},
+    {"hash", builtinHash, BUILTIN_SHELL},
+    {"jobs", builtinJobs, BUILTIN_SHELL},
+    {"wait", builtinWait, BUILTIN_SHELL}, // asynchronous on the SERVER (connJobNext)
+    {"fg", builtinFg, BUILTIN_SHELL},
+    {"kill", builtinKill, BUILTIN_SHELL},
+    {"stats", builtinStats, BUILTIN_SHELL},
+    {"parallel", parallelRun, BUILTIN_FORKED},
+    {NULL, NULL, 0}
+};
+
+// builtin of the given command name, NULL if there is none
+const builtin_t *builtinFind(const char *name) {
+    const builtin_t *b;
+    for (b = builtins; b->name != NULL; b++)
+        if (strcmp(b->name, name) == 0) return b;
+    return NULL;
+}
+
+// the pipeline is a single builtin stage that runs in the shell process (see builtinInProcess)
+char builtinInShell(pipeline_t *pipeline) {
+    const builtin_t *b;
+    cmd_t *cmd = pipeline->stages;
+    if (pipeline->count != 1 || cmd->argc == 0 || (b = builtinFind(cmd->argv[0])) == NULL) return 0;
+    return b->where == BUILTIN_SHELL;
+}
+
+// run a pipeline of a single builtin stage in the shell process itself (no fork)
+// its redirections are applied to the shell's STDIN/STDOUT for the time it runs
+// (the SERVER's STDOUT and STDERR are memfds, its output is framed for the session by connCaptureStdout)
+// returns 1 if the builtin ran (its wait status stored into (*wstatus)), 0 if the pipeline has to be started
+char builtinInProcess(pipeline_t *pipeline, int *wstatus) {
+    cmd_t *cmd = pipeline->stages;
+    const builtin_t *b;
+    int saved[2] = {-1, -1};
+    const char *files[2] = {cmd->redir_in, cmd->redir_out};
+    int i, fd, status = 1;
+
+    if (pipeline->count == 1 && cmd->argc == 0 && cmd->assigns_count > 0) {
+        // "NAME=value" alone sets shell variables
+        for (i = 0, status = 0; i < cmd->assigns_count; i++) status |= varAssign(cmd->assigns[i], 0);
+        (*wstatus) = status << 8;
+        return 1;
+    }
+    if (!builtinInShell(pipeline)) return 0;
+    b = builtinFind(cmd->argv[0]);
+
+    fflush(stdout);
+    for (i = STDIN_FILENO; i <= STDOUT_FILENO; i++) {
+        if (files[i] == NULL) continue;
+        // same flags as handleChild
+        if ((fd = (i == STDIN_FILENO) ? open(files[i], O_RDONLY) : open(files[i], O_WRONLY | O_CREAT, 0644)) < 0) {
+            perror((i == STDIN_FILENO) ? "Failed to open input file" : "Failed to open output file");
+            break;
+        }
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        sc_dup3(fd, i, 0);
+        close(fd);
+    }
+    if (i > STDOUT_FILENO) status = b->run(cmd->argc, cmd->argv);
+    fflush(stdout);
+    for (i = STDIN_FILENO; i <= STDOUT_FILENO; i++) {
+        if (saved[i] == -1) continue;
+        sc_dup3(saved[i], i, 0);
+        close(saved[i]);
+    }
+    (*wstatus) = status << 8; // as if the stage exited with it
+    return 1;
+}
+
+// resource usage of a command line (summed over its stages, see "time")
+typedef struct {
+    double real;                        // wall-clock seconds
+    double user;                        // CPU seconds in user mode
+    double sys;                         // CPU seconds in the kernel
+    long maxrss;                        // largest resident set of a stage (KiB)
+    long nvcsw;                         // voluntary context switches (waiting for I/O)
+    long nivcsw;                        // involuntary context switches (preempted)
+} usage_t;
+
+// monotonic clock in seconds (vDSO, no syscall)
+double clockSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// add the resource usage of a finished stage
+void usageAdd(usage_t *usage, const struct rusage *ru) {
+    usage->user += ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    usage->sys += ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    if (ru->ru_maxrss > usage->maxrss) usage->maxrss = ru->ru_maxrss;
+    usage->nvcsw += ru->ru_nvcsw;
+    usage->nivcsw += ru->ru_nivcsw;
+}
+
+// add the usage of a whole pipeline (a timed pipeline of a line that is timed too)
+void usageMerge(usage_t *usage, const usage_t *from) {
+    usage->user += from->user;
+    usage->sys += from->sys;
+    if (from->maxrss > usage->maxrss) usage->maxrss = from->maxrss;
+    usage->nvcsw += from->nvcsw;
+    usage->nivcsw += from->nivcsw;
+}
+
+// usage as a single line of "key value" pairs (without '\n'), returns its length
+int usageFormat(char *buffer, int size, const usage_t *usage) {
+    return snprintf(buffer, size, "real %.6f user %.6f sys %.6f maxrss_kib %ld vcsw %ld ivcsw %ld",
+        usage->real, usage->user, usage->sys, usage->maxrss, usage->nvcsw, usage->nivcsw);
+}
+
+// wait for all stages of a pipeline forked by runInput, their resource usage is added to usage (if not NULL)
+// returns the wait status of the last stage (the status a pipeline is judged by)
+int waitPipeline(pid_t *pids, int count, usage_t *usage) {
+    struct rusage ru;
+    int i;
+    int wstatus = 0;
+    int last = 0;
+    for (i = 0; i < count; i++) {
+        char ended = 0;
+        do {
+            // man 2 wait4 (waitpid + resource usage of the child), retried when a signal interrupts it
+            int r;
+            while ((r = sc_wait4(pids[i], &wstatus, WUNTRACED, &ru)) == -1 && errno == EINTR);
+            if (r == -1) {
+                perror("waitpid");
+                break;
+            }
+            ended = WIFEXITED(wstatus) || WIFSIGNALED(wstatus);
+        } while (!ended);
+        if (usage != NULL && ended) usageAdd(usage, &ru);
+        // printf("child [%d] exited with status [%d]\n", pids[i], wstatus);
+        if (i == count - 1) last = wstatus;
+    }
+    return last;
+}
+
+// fork every stage of the pipeline without waiting for it
+// all stages of a '|' chain are forked up front so they run concurrently (no pipe buffer deadlock)
+// stage pids are stored into (*pids) (grown as needed)
+// out_fd, err_fd (if not -1) replace STDOUT and STDERR of the stages (output of server-side jobs)
+// returns 1 if not all stages could be started
+char startPipeline(pipeline_t *pipeline, int out_fd, int err_fd, pid_t **pids, int *pids_count, int *pids_size) {
+    char is_pipe = IS_PIPE_NONE; // if the last run was piped as input, the next one has to receive pipe output
+    int fd_pipe_l[2] = {-1, -1}; // {read, write} pair
+    int fd_pipe_r[2] = {-1, -1}; // {read, write} pair
+    cmd_t *cmd;
+
+    (*pids_count) = 0;
+    for (cmd = pipeline->stages; cmd != NULL; cmd = cmd->next) {
+
+        // pipe preparation if pipe found on the right side of this command
+        if (cmd->next != NULL) {
+            // Create a new pipe (close-on-exec, only the dup2'd ends reach the command)
+            if (sc_pipe2(fd_pipe_r, O_CLOEXEC) != 0) {
+                perror("Pipe error");
+                break;
+            }
+            // There may be either the new pipe on right or an already existing one on left + the new one
+            is_pipe = (is_pipe == IS_PIPE_LEFT) ? IS_PIPE_BOTH : IS_PIPE_RIGHT;
+        }
+
+        // make room for this stage's pid
+        if ((*pids_count) == (*pids_size)) {
+            pid_t *grown = realloc((*pids), ((*pids_size) + 8) * sizeof(pid_t));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation error.\n");
+                break;
+            }
+            (*pids) = grown;
+            (*pids_size) += 8;
+        }
+
+        // command location is resolved in the parent, so it is remembered for the next run
+        const builtin_t *found = (cmd->argc > 0) ? builtinFind(cmd->argv[0]) : NULL;
+        int (*builtin)(int, char *const[]) = (found != NULL) ? found->run : NULL;
+        const char *shell_path = (cmd->argc > 0 && builtin == NULL) ? hashLookup(cmd->argv[0]) : NULL;
+        // exported variables (cached), with the command's own assignments on top
+        char **overlay = (cmd->assigns_count > 0) ? varsOverlay(cmd->assigns, cmd->assigns_count) : NULL;
+        char **envp = (overlay != NULL) ? overlay : varsEnvp();
+
+        pid_t pid = -1;
+        fflush(stdout); // don't let the child inherit (and later repeat) unflushed output
+
+        // spawn fast path for commands that have been found
+        if (cmd->argc > 0 && builtin == NULL && (shell_path != NULL || strchr(cmd->argv[0], '/') != NULL))
+            pid = spawnStage((shell_path != NULL) ? shell_path : cmd->argv[0], cmd->argv, envp,
+                             cmd->redir_in, cmd->redir_out,
+                             is_pipe, fd_pipe_l[PIPE_READ], fd_pipe_r[PIPE_WRITE],
+                             out_fd, err_fd);
+
+        // fork execution (the child runs shell code: builtin stages, empty commands, commands not found, failed redirections)
+        if (pid == -1) pid = fork(); // man 2 fork
+        if (pid != 0) free(overlay);
+        if (pid == -1) {
+            perror("Fork error");
+            break;
+        } else if (pid == 0) {
+            // forked child process
+
+            // the shell may have blocked signals for its own use (SIGCHLD on the server)
+            sigprocmask(SIG_SETMASK, &shell_sigmask_child, NULL);
+            if (out_fd != -1) sc_dup3(out_fd, STDOUT_FILENO, 0);
+            if (err_fd != -1) sc_dup3(err_fd, STDERR_FILENO, 0);
+            handleChild(shell_path, cmd->argv, cmd->argc, envp, cmd->redir_in, cmd->redir_out, is_pipe,
+                        &(fd_pipe_l[PIPE_READ]), &(fd_pipe_l[PIPE_WRITE]),
+                        &(fd_pipe_r[PIPE_READ]), &(fd_pipe_r[PIPE_WRITE]), builtin);
+            _exit(ERR_EXECFAIL);
+
+        }
+
+        // parent process
+        // pid is set to child pid
+        (*pids)[(*pids_count)++] = pid;
+
+        if (is_pipe == IS_PIPE_LEFT || is_pipe == IS_PIPE_BOTH) {
+            // close left-side pipes for parent process
+            close(fd_pipe_l[PIPE_READ]); fd_pipe_l[PIPE_READ] = -1;
+            close(fd_pipe_l[PIPE_WRITE]); fd_pipe_l[PIPE_WRITE] = -1;
+            is_pipe = (is_pipe == IS_PIPE_BOTH) ? IS_PIPE_RIGHT : IS_PIPE_NONE;
+        }
+
+        if (is_pipe == IS_PIPE_RIGHT) { // move the pipe for next command from right to left
+            fd_pipe_l[PIPE_READ] = fd_pipe_r[PIPE_READ]; fd_pipe_r[PIPE_READ] = -1;
+            fd_pipe_l[PIPE_WRITE] = fd_pipe_r[PIPE_WRITE]; fd_pipe_r[PIPE_WRITE] = -1;
+            is_pipe = IS_PIPE_LEFT; // now on the left of the next command
+        }
+    }
+
+    // pipeline cut short by an error: release its pipes (the started stages are still collected by the caller)
+    if (fd_pipe_l[PIPE_READ] != -1) close(fd_pipe_l[PIPE_READ]);
+    if (fd_pipe_l[PIPE_WRITE] != -1) close(fd_pipe_l[PIPE_WRITE]);
+    if (fd_pipe_r[PIPE_READ] != -1) close(fd_pipe_r[PIPE_READ]);
+    if (fd_pipe_r[PIPE_WRITE] != -1) close(fd_pipe_r[PIPE_WRITE]);
+    return cmd != NULL;
+}
+
+// exit status of a command from its wait status (128 + signal number if killed, as in sh)
+int exitStatus(int wstatus) {
+    if (WIFEXITED(wstatus)) return WEXITSTATUS(wstatus);
+    if (WIFSIGNALED(wstatus)) return 128 + WTERMSIG(wstatus);
+    return 0;
+}
+
+// --------------------------------------
+// background jobs ('&')
+// --------------------------------------
+
+// pipeline started with '&', its stages are reaped asynchronously (LOCAL: SIGCHLD, SERVER: signalfd)
+typedef struct job {
+    int id;                             // job number (%n)
+    pid_t *pids;                        // stages, -1 once reaped
+    int count;
+    int running;                        // stages not reaped yet
+    int status;                         // wait status of the last stage
+    char *cmdline;                      // for "jobs"
+    struct job *next;
+} job_t;
+
+// job table (of the LOCAL shell or of a server connection)
+typedef struct {
+    job_t *head;
+    int last_id;
+} jobs_t;
+
+// SIGCHLD arrived (LOCAL), children are reaped at the next prompt or job builtin
+volatile sig_atomic_t jobs_sigchld = 0;
+
+// jobs the job builtins work on: the LOCAL shell's, or the ones of the session being served
+jobs_t *shell_jobs = NULL;
+
+void jobsChild(int sig) {
+    (void)sig;
+    jobs_sigchld = 1;
+}
+
+// install the SIGCHLD handler of the LOCAL shell (only sets a flag, see jobsReap)
+void jobsInit() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = jobsChild;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+// free the job and unlink it from the table
+void jobRemove(jobs_t *jobs, job_t *job) {
+    job_t **at;
+    for (at = &(jobs->head); (*at) != NULL; at = &((*at)->next)) {
+        if ((*at) != job) continue;
+        (*at) = job->next;
+        break;
+    }
+    if (jobs->head == NULL) jobs->last_id = 0; // numbering starts over once all jobs are gone
+    free(job->pids);
+    free(job->cmdline);
+    free(job);
+}
+
+// job of a "%n" or "n" spec, the most recent one if spec is empty
+job_t *jobFind(jobs_t *jobs, const char *spec) {
+    job_t *job, *last = NULL;
+    while ((*spec) == ' ') spec++;
+    if ((*spec) == '%') spec++;
+    int id = atoi(spec);
+    for (job = jobs->head; job != NULL; job = job->next) {
+        if ((*spec) == '\0') last = job;
+        else if (job->id == id) return job;
+    }
+    return last;
+}
+
+// start the pipeline as a new job (output into out_fd/err_fd if not -1), "[n] pid" is printed
+// returns the job, NULL if no stage could be started
+job_t *jobStart(jobs_t *jobs, pipeline_t *pipeline, const char *input, int out_fd, int err_fd) {
+    job_t *job = calloc(1, sizeof(job_t));
+    int size = 0;
+    if (job == NULL || (job->cmdline = strndup(input + pipeline->text_start, pipeline->text_end - pipeline->text_start)) == NULL) {
+        fprintf(stderr, "Memory allocation error.\n");
+        free(job);
+        return NULL;
+    }
+    startPipeline(pipeline, out_fd, err_fd, &(job->pids), &(job->count), &size);
+    job->running = job->count;
+    job->id = ++(jobs->last_id);
+    job->next = NULL;
+    job_t **at = &(jobs->head);
+    while ((*at) != NULL) at = &((*at)->next);
+    (*at) = job;
+    if (job->count == 0) {
+        jobRemove(jobs, job);
+        return NULL;
+    }
+    printf("[%d] %d\n", job->id, (int)job->pids[job->count - 1]);
+    return job;
+}
+
+// record a reaped child in the job it belongs to
+// returns the job, NULL if pid isn't a stage of any job
+job_t *jobReaped(jobs_t *jobs, pid_t pid, int wstatus) {
+    job_t *job;
+    int i;
+    for (job = jobs->head; job != NULL; job = job->next) {
+        for (i = 0; i < job->count; i++) {
+            if (job->pids[i] != pid) continue;
+            job->pids[i] = -1;
+            job->running--;
+            if (i == job->count - 1) job->status = wstatus;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// reap every finished child without blocking (LOCAL: only jobs can have children while this runs)
+void jobsReap(jobs_t *jobs) {
+    int wstatus;
+    pid_t pid;
+    while ((pid = sc_wait4(-1, &wstatus, WNOHANG, NULL)) > 0) jobReaped(jobs, pid, wstatus);
+}
+
+// one line of "jobs" output
+void jobPrint(job_t *job) {
+    char state[32];
+    if (job->running > 0) snprintf(state, sizeof(state), "Running");
+    else if (WIFSIGNALED(job->status)) snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(job->status)));
+    else if (exitStatus(job->status) != 0) snprintf(state, sizeof(state), "Exit %d", exitStatus(job->status));
+    else snprintf(state, sizeof(state), "Done");
+    printf("[%d]  %-12s %s\n", job->id, state, job->cmdline);
+}
+
+// print the finished jobs (if print) and drop them from the table (before the next prompt)
+void jobsNotify(jobs_t *jobs, char print) {
+    job_t *job = jobs->head;
+    while (job != NULL) {
+        job_t *next = job->next;
+        if (job->running == 0) {
+            if (print) jobPrint(job);
+            jobRemove(jobs, job);
+        }
+        job = next;
+    }
+}
+
+// "jobs": all jobs, the finished ones are reported once
+void jobsList(jobs_t *jobs) {
+    job_t *job;
+    for (job = jobs->head; job != NULL; job = job->next)
+        if (job->running > 0) jobPrint(job);
+    jobsNotify(jobs, 1);
+}
+
+// job of "wait [%n]" (all jobs without a spec, (*all) is set) or "fg [%n]" (most recent job without a spec)
+// the command line of the job is printed for fg
+// returns NULL if there is no such job (or all jobs are meant)
+job_t *jobsTarget(jobs_t *jobs, const char *spec, char fg, char *all) {
+    job_t *job;
+    while ((*spec) == ' ') spec++;
+    (*all) = ((*spec) == '\0' && !fg);
+    if ((*all)) return NULL;
+    if ((job = jobFind(jobs, spec)) == NULL) fprintf(stderr, "%s: No such job.\n", fg ? "fg" : "wait");
+    else if (fg) printf("%s\n", job->cmdline);
+    return job;
+}
+
+// "wait [%n]" and "fg [%n]" of the LOCAL shell (see jobsTarget)
+// there is no terminal job control, fg waits for the job in the foreground
+// returns the exit status of the job (0 for all jobs, 127 if there is no such job)
+int jobsWait(jobs_t *jobs, const char *spec, char fg) {
+    job_t *job;
+    int wstatus;
+    int status = 0;
+    char all;
+    job = jobsTarget(jobs, spec, fg, &all);
+    if (all) {
+        // all jobs: reap until no job is left (waited jobs aren't reported as done)
+        for (;;) {
+            for (job = jobs->head; job != NULL; ) {
+                job_t *next = job->next;
+                if (job->running == 0) jobRemove(jobs, job);
+                job = next;
+            }
+            if (jobs->head == NULL) break;
+            pid_t pid = sc_wait4(-1, &wstatus, 0, NULL);
+            if (pid == -1 && errno == EINTR) continue;
+            if (pid == -1) break;
+            jobReaped(jobs, pid, wstatus);
+        }
+        return 0;
+    }
+    if (job == NULL) return 127;
+    fflush(stdout);
+    for (int i = 0; i < job->count; i++) {
+        if (job->pids[i] == -1) continue;
+        if (sc_wait4(job->pids[i], &wstatus, 0, NULL) == -1) {
+            if (errno == EINTR) {
+                i--;
+                continue;
+            }
+            perror("waitpid");
+            break;
+        }
+        jobReaped(jobs, job->pids[i], wstatus);
+    }
+    status = exitStatus(job->status);
+    jobRemove(jobs, job);
+    return status;
+}
+
+// jobs
+int builtinJobs(int argc, char *const argv[]) {
+    (void)argc; (void)argv;
+    if (jobs_sigchld) { // LOCAL: finished jobs not reaped yet
+        jobs_sigchld = 0;
+        jobsReap(shell_jobs);
+    }
+    jobsList(shell_jobs);
+    return 0;
+}
+
+// wait [%n] (LOCAL, the SERVER responds once the jobs are done instead of blocking)
+int builtinWait(int argc, char *const argv[]) {
+    return jobsWait(shell_jobs, (argc > 1) ? argv[1] : "", 0);
+}
+
+// fg [%n]
+int builtinFg(int argc, char *const argv[]) {
+    return jobsWait(shell_jobs, (argc > 1) ? argv[1] : "", 1);
+}
+
+// kill [-SIG] %n|pid ...: signal every stage of job n, or the process (SIGTERM by default)
+int builtinKill(int argc, char *const argv[]) {
+    static const struct { const char *name; int sig; } names[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"TERM", SIGTERM}, {"STOP", SIGSTOP}, {"CONT", SIGCONT}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2}
+    };
+    int sig = SIGTERM;
+    int i = 1, j, status = 0;
+    job_t *job;
+    if (argc > 1 && argv[1][0] == '-') {
+        const char *name = argv[1] + 1;
+        if (strncmp(name, "SIG", 3) == 0) name += 3;
+        if ((*name) >= '0' && (*name) <= '9') sig = atoi(name);
+        else {
+            for (j = 0; j < (int)(sizeof(names) / sizeof(names[0])) && strcmp(name, names[j].name) != 0; j++);
+            if (j == (int)(sizeof(names) / sizeof(names[0]))) {
+                fprintf(stderr, "kill: Unknown signal.\n");
+                return 1;
+            }
+            sig = names[j].sig;
+        }
+        i++;
+    }
+    if (i == argc) {
+        fprintf(stderr, "Usage: kill [-SIG] %%n|pid ...\n");
+        return 2;
+    }
+    for (; i < argc; i++) {
+        if (argv[i][0] == '%') {
+            if ((job = jobFind(shell_jobs, argv[i])) == NULL) {
+                fprintf(stderr, "kill: %s: No such job.\n", argv[i]);
+                status = 1;
+                continue;
+            }
+            for (j = 0; j < job->count; j++)
+                if (job->pids[j] != -1 && kill(job->pids[j], sig) != 0) perror("kill");
+            continue;
+        }
+        char *end;
+        long pid = strtol(argv[i], &end, 10);
+        if (end == argv[i] || (*end) != '\0') {
+            fprintf(stderr, "kill: %s: not a job or process id\n", argv[i]);
+            status = 1;
+        } else if (kill(pid, sig) != 0) {
+            perror("kill");
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// free the table, the jobs keep running (their children are no longer tracked)
+void jobsFree(jobs_t *jobs) {
+    while (jobs->head != NULL) jobRemove(jobs, jobs->head);
+}
+
+// "time" in front of a pipeline is removed from its first stage
+// returns 1 if the pipeline is timed
+char pipelineTimed(pipeline_t *pipeline) {
+    cmd_t *cmd = pipeline->stages;
+    if (cmd == NULL || cmd->argc == 0 || strcmp(cmd->argv[0], "time") != 0) return 0;
+    cmd->argv++;
+    cmd->argc--;
+    cmd->argv_size--;
+    return 1;
+}
+
+// external command execution: handle each ';' and '|' delimited command
+// the whole line is parsed up front (nothing is executed on a syntax error), each pipeline is expanded as it starts
+// every pipeline is waited for as a whole before the command after ';' is started
+// pipelines ending with '&' are added to jobs instead (not waited for)
+// usage of all stages is stored into usage (if not NULL), a pipeline after "time" prints its own usage to STDERR
+// returns the wait status of the last executed pipeline
+int runInput(arena_t *arena, char *uinput, usage_t *usage, jobs_t *jobs) {
+    pipeline_t *pipeline;
+    char error;
+    int status = shell_status << 8;
+    double start = clockSeconds();
+    usage_t timed;
+
+    // pids of the currently running pipeline stages
+    pid_t *pids = NULL;
+    int pids_count = 0;
+    int pids_size = 0;
+
+    if (usage != NULL) memset(usage, 0, sizeof(usage_t));
+    pipeline = parseLine(arena, uinput, &error);
+    if (error) status = 2 << 8; // syntax error (exit status 2, as in sh)
+    for (; pipeline != NULL; pipeline = pipeline->next) {
+        shell_status = exitStatus(status); // "$?" of the pipeline
+        if (pipelineExpand(arena, pipeline) != 0) {
+            status = 1 << 8;
+            continue;
+        }
+        char is_timed = pipelineTimed(pipeline);
+        if (pipeline->background) { // not timed
+            status = (jobStart(jobs, pipeline, uinput, -1, -1) == NULL) ? 1 << 8 : 0;
+            continue;
+        }
+        if (is_timed) {
+            memset(&timed, 0, sizeof(timed));
+            timed.real = clockSeconds();
+        }
+        if (!builtinInProcess(pipeline, &status)) { // echo, cd, test, ... without a fork
+            startPipeline(pipeline, -1, -1, &pids, &pids_count, &pids_size);
+            // must wait for the whole group to finish
+            // then resume with the next command / interactive shell
+            if (pids_count > 0) status = waitPipeline(pids, pids_count, is_timed ? &timed : usage);
+        }
+        if (is_timed) {
+            char line[256];
+            timed.real = clockSeconds() - timed.real;
+            usageFormat(line, sizeof(line), &timed);
+            fflush(stdout);
+            fprintf(stderr, "%s\n", line);
+            if (usage != NULL) usageMerge(usage, &timed);
+        }
+    }
+    free(pids);
+    arenaReset(arena);
+    if (usage != NULL) usage->real = clockSeconds() - start;
+
+    return status;
+}
+
+// --------------------------------------
+// command input (LOCAL and CLIENT)
+// --------------------------------------
+
+// longest command line accepted: the kernel's ARG_MAX (execve can't take more arguments anyway)
+int shellLineMax() {
+    static int max = 0;
+    if (max == 0) {
+        long arg_max = sysconf(_SC_ARG_MAX);
+        max = (arg_max > SHELL_READER_BUFFER && arg_max < INT_MAX / 4) ? (int)arg_max : SHELL_READER_BUFFER;
+    }
+    return max;
+}
+
+// buffered line reader over a descriptor (STDIN or a script), one read() fills it with many lines
+typedef struct {
+    int fd;
+    char *buffer;                       // size + 1 bytes, incl. '\0' after a last line without '\n' (allocated on first use)
+    int size;                           // SHELL_READER_BUFFER, grown for longer lines up to shellLineMax()
+    int start;                          // first byte not returned yet
+    int end;                            // end of the read data
+    char eof;
+    char skipping;                      // rest of a line too long for the buffer is being dropped
+} reader_t;
+
+// a whole line is buffered (the next readerLine doesn't read)
+char readerPending(reader_t *r) {
+    if (r->buffer == NULL) return 0;
+    return memchr(r->buffer + r->start, '\n', r->end - r->start) != NULL || (r->eof && r->start < r->end);
+}
+
+// next line of input without its '\n', stored in place in the reader buffer (valid until the next call)
+// returns NULL at the end of input
+char *readerLine(reader_t *r, int *len) {
+    char *nl;
+    char *line;
+    while ((nl = memchr(r->buffer + r->start, '\n', r->end - r->start)) == NULL || r->skipping) {
+        if (nl != NULL) { // end of an overlong line
+            r->start = nl + 1 - r->buffer;
+            r->skipping = 0;
+            continue;
+        }
+        if (r->eof) {
+            if (r->start == r->end || r->skipping) return NULL;
+            nl = r->buffer + r->end; // last line without '\n'
+            break;
+        }
+        if (r->start > 0) { // make room behind the unfinished line
+            memmove(r->buffer, r->buffer + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->size && !r->skipping) { // unfinished line fills the buffer (or there is none yet)
+            int size = r->size ? r->size * 2 : SHELL_READER_BUFFER;
+            char *grown = (r->size < shellLineMax()) ? realloc(r->buffer, size + 1) : NULL;
+            if (grown != NULL) {
+                r->buffer = grown;
+                r->size = size;
+            } else if (r->buffer == NULL) return NULL;
+        }
+        if (r->end == r->size) {
+            fprintf(stderr, "Input line too long.\n");
+            r->start = r->end = 0;
+            r->skipping = 1;
+        }
+        int n = sc_read(r->fd, r->buffer + r->end, r->size - r->end);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) r->eof = 1;
+        else r->end += n;
+    }
+    (*nl) = '\0';
+    line = r->buffer + r->start;
+    (*len) = nl - line;
+    r->start = (nl - r->buffer) + ((nl < r->buffer + r->end) ? 1 : 0);
+    return line;
+}
+
+// read a whole command into (*uinput) (of (*size) bytes, grown up to shellLineMax() for long commands)
+// it continues on the next line after a trailing '\' or while a quote is open (the newline is kept inside the quotes)
+// continuation lines get a "> " prompt if interactive
+// returns 1 at the end of input
+char readCommand(reader_t *r, char **uinput, int *size, char interactive) {
+    int len = 0;
+    int n;
+    char *line;
+    while ((line = readerLine(r, &n)) != NULL) {
+        char quote = 0;
+        char escaped = 0;
+        int i;
+        if (len + n + 2 > (*size)) {
+            int grow = (*size) * 2;
+            while (grow < len + n + 2) grow *= 2;
+            char *grown = (len + n + 2 <= shellLineMax()) ? realloc((*uinput), grow) : NULL;
+            if (grown == NULL) {
+                fprintf(stderr, "Input line too long.\n");
+                (*uinput)[0] = '\0';
+                return 0;
+            }
+            (*uinput) = grown;
+            (*size) = grow;
+        }
+        char *cmd = (*uinput);
+        memcpy(cmd + len, line, n);
+        len += n;
+        cmd[len] = '\0';
+
+        // same quoting rules as parseLine
+        for (i = 0; i < len; i++) {
+            if (escaped) escaped = 0;
+            else if (cmd[i] == '\\') escaped = 1;
+            else if (cmd[i] == '\"') quote = !quote;
+            else if (cmd[i] == '#' && !quote) break; // comment, nothing continues
+        }
+        if (i == len && escaped) cmd[--len] = '\0'; // line continuation
+        else if (i == len && quote) {
+            cmd[len++] = '\n';
+            cmd[len] = '\0';
+        } else return 0;
+
+        if (interactive) {
+            fputs("> ", stdout);
+            fflush(stdout);
+        }
+    }
+    return (len > 0) ? 0 : 1; // unfinished command at the end of input is still executed
+}
+
+// --------------------------------------
+// persistent history (memory-mapped ring buffer)
+// --------------------------------------
+
+// the history file is a header followed by a ring of records, records are appended at head and evicted at tail
+// record: length (uint32_t), command, '\0', padded to HISTORY_ALIGN (a HISTORY_WRAP length skips to the ring start)
+// offsets grow monotonically, their position in the ring is offset % data_size
+#define HISTORY_MAGIC "SEEHIST1"
+#define HISTORY_ALIGN 4
+#define HISTORY_WRAP 0xFFFFFFFFu
+#define HISTORY_RECORD_SIZE(len) ((sizeof(uint32_t) + (len) + 1 + HISTORY_ALIGN - 1) & ~(uint64_t)(HISTORY_ALIGN - 1))
+
+typedef struct {
+    char magic[8];
+    uint64_t data_size;                 // ring size in bytes (fixed when the file is created)
+    uint64_t head;                      // offset the next record is written to
+    uint64_t tail;                      // offset of the oldest record
+    uint64_t count;                     // records in the ring
+    uint64_t total;                     // records ever pushed (numbering in printHistory)
+} history_header_t;
+
+// commands containing a trigram (see searchHistory)
+typedef struct {
+    uint32_t key;                       // trigram + 1, 0 if the slot is empty
+    uint32_t start;                     // numbers before start belong to evicted commands
+    uint32_t len;
+    uint32_t size;
+    uint64_t *numbers;                  // ascending command numbers
+} history_posting_t;
+
+typedef struct {
+    history_header_t *header;           // mapping of the whole file (or anonymous memory without a file)
+    char *data;                         // ring after the header
+    size_t map_size;
+    int fd;                             // history file, -1 if the history is kept in memory only
+    history_posting_t *index;           // trigram index (hash table, NULL until the first search)
+    uint32_t index_size;
+    uint32_t index_used;
+    uint64_t *offsets;                  // ring position of each indexed command (by number % SHELL_HISTORY_MAX)
+    uint64_t index_first;               // oldest command number when the index was built
+    uint64_t indexed_offset;            // offset of the first command not indexed yet
+    uint64_t indexed_number;            // its number
+} history_t;
+
+const char *historyNext(history_t *h, uint64_t *offset);
+
+// check the header and every record of a mapped history (a truncated or damaged file, or one of another build)
+// returns 1 if the history can be used as it is
+char historyValid(history_t *h) {
+    history_header_t *hh = h->header;
+    uint64_t offset, count = 0;
+    if (hh->data_size != h->map_size - sizeof(history_header_t) || hh->data_size == 0 || hh->data_size % HISTORY_ALIGN != 0
+        || hh->tail > hh->head || hh->head - hh->tail > hh->data_size || hh->tail % HISTORY_ALIGN != 0
+        || hh->count > SHELL_HISTORY_MAX || hh->count > hh->total) return 0;
+    for (offset = hh->tail; historyNext(h, &offset) != NULL; count++);
+    return offset == hh->head && count == hh->count;
+}
+
+// map the history file ($SEEHELL_HISTFILE or ~/.seehell_history), created on first use
+// history is kept in memory only if the file can't be used, or without file (sessions of the server)
+// returns 1 on error
+char allocHistory(history_t *h, char file) {
+    char path[PATH_MAX + sizeof(SHELL_HISTORY_FILE) + 1];
+    const char *env = getenv("SEEHELL_HISTFILE");
+    struct stat st;
+
+    if (env != NULL) snprintf(path, sizeof(path), "%s", env);
+    else snprintf(path, sizeof(path), "%s/%s", prompt_cache.home, SHELL_HISTORY_FILE);
+
+    h->map_size = sizeof(history_header_t) + SHELL_HISTORY_BYTES;
+    h->fd = file ? open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600) : -1;
+    if (h->fd != -1) {
+        // the file is checked, sized and set up under the lock (another shell may be starting on the same file)
+        int r;
+        while ((r = flock(h->fd, LOCK_EX)) == -1 && errno == EINTR);
+        if (r != 0 || fstat(h->fd, &st) != 0) {
+            close(h->fd); h->fd = -1;
+        }
+    }
+    if (h->fd != -1) {
+        history_header_t existing;
+        static const history_header_t blank;  // header of a history whose setup didn't finish
+        char got = st.st_size >= (off_t)sizeof(existing) && pread(h->fd, &existing, sizeof(existing), 0) == sizeof(existing);
+        char ours = got && (memcmp(existing.magic, HISTORY_MAGIC, 8) == 0 || memcmp(&existing, &blank, sizeof(blank)) == 0);
+        if (ours && existing.data_size % HISTORY_ALIGN == 0 && existing.data_size > 0
+            && st.st_size == (off_t)(sizeof(existing) + existing.data_size)) h->map_size = st.st_size; // keeps its own ring size
+        else if (st.st_size != 0 && !ours) { // never overwrite a file that isn't a history of this shell
+            fprintf(stderr, "%s is not a seeHell history file, history is kept in memory only.\n", path);
+            close(h->fd); h->fd = -1;
+        } else if (ftruncate(h->fd, 0) != 0 || ftruncate(h->fd, h->map_size) != 0) { // new or damaged history
+            perror("History file error");
+            close(h->fd); h->fd = -1;
+        }
+    }
+
+    // man 2 mmap (the file is shared, so it's written back by the kernel and loads without parsing)
+    if (h->fd != -1) h->header = mmap(NULL, h->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+    else h->header = mmap(NULL, h->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (h->header == MAP_FAILED) {
+        fprintf(stderr, "Memory allocation error (history).\n");
+        if (h->fd != -1) close(h->fd);
+        return 1;
+    }
+    h->data = (char *)(h->header + 1);
+    h->index = NULL;
+    h->offsets = NULL;
+    h->index_size = h->index_used = 0;
+    if (memcmp(h->header->magic, HISTORY_MAGIC, 8) != 0 || !historyValid(h)) { // new (zero-filled) or corrupt history
+        if (memcmp(h->header->magic, HISTORY_MAGIC, 8) == 0) fprintf(stderr, "History file is corrupt, starting a new one.\n");
+        memset(h->header, 0, sizeof(history_header_t));
+        memcpy(h->header->magic, HISTORY_MAGIC, 8);
+        h->header->data_size = h->map_size - sizeof(history_header_t);
+    }
+    if (h->fd != -1) flock(h->fd, LOCK_UN);
+    return 0;
+}
+
+// record at the given offset, (*offset) is moved to the next record
+// every record is checked against the ring bounds (the file is shared and may be damaged)
+// returns the command, NULL at head or at a record that doesn't fit
+const char *historyNext(history_t *h, uint64_t *offset) {
+    history_header_t *hh = h->header;
+    while ((*offset) < hh->head) {
+        uint64_t pos = (*offset) % hh->data_size;
+        uint32_t len;
+        if (pos + sizeof(len) > hh->data_size) return NULL;
+        memcpy(&len, h->data + pos, sizeof(len));
+        if (len == HISTORY_WRAP) {
+            (*offset) += hh->data_size - pos;
+            continue;
+        }
+        if (HISTORY_RECORD_SIZE(len) > hh->data_size - pos || (*offset) + HISTORY_RECORD_SIZE(len) > hh->head
+            || h->data[pos + sizeof(len) + len] != '\0') return NULL;
+        (*offset) += HISTORY_RECORD_SIZE(len);
+        return h->data + pos + sizeof(len);
+    }
+    return NULL;
+}
+
+// every command is indexed under each 3-byte substring (trigram) it contains
+// a substring search only verifies the commands listed under the rarest trigram of the pattern
+// the index is built on the first search and kept up to date by pushHistory (including commands of other shells)
+
+// trigram of the 3 bytes at p
+#define HISTORY_TRIGRAM(p) (((uint32_t)(unsigned char)(p)[0] << 16) | ((uint32_t)(unsigned char)(p)[1] << 8) | (unsigned char)(p)[2])
+
+// position of the posting list of a trigram in the index (open addressing), created if requested
+// returns NULL if not found (or on allocation error)
+history_posting_t *historyPosting(history_t *h, uint32_t trigram, char create) {
+    uint32_t key = trigram + 1; // 0 marks an empty slot
+    uint32_t i;
+
+    // keep the table at most half full
+    if (create && (h->index_used + 1) * 2 > h->index_size) {
+        uint32_t size = h->index_size ? h->index_size * 2 : 4096;
+        history_posting_t *grown = calloc(size, sizeof(history_posting_t));
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation error (history index).\n");
+            return NULL;
+        }
+        for (i = 0; i < h->index_size; i++) {
+            uint32_t j;
+            if (h->index[i].key == 0) continue;
+            for (j = (h->index[i].key * 2654435761u) & (size - 1); grown[j].key != 0; j = (j + 1) & (size - 1));
+            grown[j] = h->index[i];
+        }
+        free(h->index);
+        h->index = grown;
+        h->index_size = size;
+    }
+    if (h->index_size == 0) return NULL;
+
+    for (i = (key * 2654435761u) & (h->index_size - 1); h->index[i].key != 0; i = (i + 1) & (h->index_size - 1))
+        if (h->index[i].key == key) return &(h->index[i]);
+    if (!create) return NULL;
+    h->index[i].key = key;
+    h->index_used++;
+    return &(h->index[i]);
+}
+
+// drop evicted commands from the front of a posting list (numbers are ascending)
+void historyPostingTrim(history_posting_t *p, uint64_t first) {
+    while (p->start < p->len && p->numbers[p->start] < first) p->start++;
+    if (p->start > 0 && p->start * 2 >= p->len) { // compact once half of the list is gone
+        memmove(p->numbers, p->numbers + p->start, (p->len - p->start) * sizeof(uint64_t));
+        p->len -= p->start;
+        p->start = 0;
+    }
+}
+
+// free the index (rebuilt by the next search)
+void historyIndexFree(history_t *h) {
+    uint32_t i;
+    for (i = 0; i < h->index_size; i++) free(h->index[i].numbers);
+    free(h->index);
+    free(h->offsets);
+    h->index = NULL;
+    h->offsets = NULL;
+    h->index_size = h->index_used = 0;
+}
+
+// index the commands pushed since the last call (by this or other shells sharing the file)
+// the caller holds the file lock
+void historyIndexUpdate(history_t *h) {
+    uint64_t first = h->header->total - h->header->count + 1; // number of the oldest command
+    uint64_t offset, record;
+    const char *cmd;
+
+    // the index is rebuilt once the evicted commands it still lists could outnumber the live ones
+    if (h->offsets != NULL && first - h->index_first > SHELL_HISTORY_MAX) historyIndexFree(h);
+    if (h->offsets == NULL) {
+        if ((h->offsets = malloc(SHELL_HISTORY_MAX * sizeof(uint64_t))) == NULL) {
+            fprintf(stderr, "Memory allocation error (history index).\n");
+            return;
+        }
+        h->index_first = first;
+        h->indexed_number = 0; // start over at the tail
+    }
+    // commands evicted before being indexed are skipped
+    if (h->indexed_number < first) {
+        h->indexed_offset = h->header->tail;
+        h->indexed_number = first;
+    }
+
+    for (offset = h->indexed_offset; (cmd = historyNext(h, &offset)) != NULL; h->indexed_number++) {
+        int len = strlen(cmd);
+        int i;
+        record = cmd - sizeof(uint32_t) - h->data;
+        h->offsets[h->indexed_number % SHELL_HISTORY_MAX] = record;
+        for (i = 0; i + 3 <= len; i++) {
+            history_posting_t *p = historyPosting(h, HISTORY_TRIGRAM(cmd + i), 1);
+            if (p == NULL) return;
+            if (p->len > p->start && p->numbers[p->len - 1] == h->indexed_number) continue; // trigram repeated in the command
+            historyPostingTrim(p, first);
+            if (p->len == p->size) {
+                uint32_t size = p->size ? p->size * 2 : 4;
+                uint64_t *grown = realloc(p->numbers, size * sizeof(uint64_t));
+                if (grown == NULL) {
+                    fprintf(stderr, "Memory allocation error (history index).\n");
+                    return;
+                }
+                p->numbers = grown;
+                p->size = size;
+            }
+            p->numbers[p->len++] = h->indexed_number;
+        }
+        h->indexed_offset = offset;
+    }
+}
+
+// print the commands containing pattern, oldest first
+// returns 1 if nothing was found
+char searchHistory(history_t *h, const char *pattern) {
+    uint64_t first = h->header->total - h->header->count + 1;
+    history_posting_t *rarest = NULL;
+    int len = strlen(pattern);
+    char found = 0;
+    int i;
+
+    if (h->fd != -1) flock(h->fd, LOCK_SH);
+    historyIndexUpdate(h);
+
+    if (len < 3 || h->offsets == NULL) {
+        // too short for a trigram (or no index): scan every command
+        uint64_t offset = h->header->tail;
+        uint64_t number = first;
+        const char *cmd;
+        for (; (cmd = historyNext(h, &offset)) != NULL; number++) {
+            if (strstr(cmd, pattern) == NULL) continue;
+            printf("  %lu\t%s\n", (unsigned long)number, cmd);
+            found = 1;
+        }
+    } else {
+        // candidates are the commands under the rarest trigram of the pattern
+        for (i = 0; i + 3 <= len; i++) {
+            history_posting_t *p = historyPosting(h, HISTORY_TRIGRAM(pattern + i), 0);
+            if (p == NULL) { // trigram not in any command
+                rarest = NULL;
+                break;
+            }
+            historyPostingTrim(p, first);
+            if (rarest == NULL || p->len - p->start < rarest->len - rarest->start) rarest = p;
+        }
+        for (i = (rarest != NULL) ? (int)rarest->start : 0; rarest != NULL && i < (int)rarest->len; i++) {
+            uint64_t number = rarest->numbers[i];
+            const char *cmd = h->data + h->offsets[number % SHELL_HISTORY_MAX] + sizeof(uint32_t);
+            if (strstr(cmd, pattern) == NULL) continue;
+            printf("  %lu\t%s\n", (unsigned long)number, cmd);
+            found = 1;
+        }
+    }
+
+    if (h->fd != -1) flock(h->fd, LOCK_UN);
+    return !found;
+}
+
+// evict the oldest record
+void historyEvict(history_t *h) {
+    uint64_t offset = h->header->tail;
+    if (historyNext(h, &offset) == NULL) return;
+    h->header->tail = offset;
+    h->header->count--;
+}
+
+// append a command, O(1): a copy of the command plus evictions of as many old records as it displaces
+void pushHistory(history_t *h, const char *uinput) {
+    history_header_t *hh = h->header;
+    uint32_t len = strlen(uinput);
+    uint64_t size = HISTORY_RECORD_SIZE(len);
+    uint64_t pos;
+
+    if (len == 0 || size > hh->data_size / 2) return;
+    if (h->fd != -1) flock(h->fd, LOCK_EX); // other shells share the file
+
+    // a record is never split, the rest of the ring is skipped if it doesn't fit
+    pos = hh->head % hh->data_size;
+    if (pos + size > hh->data_size) {
+        while (hh->count > 0 && hh->head + (hh->data_size - pos) - hh->tail > hh->data_size) historyEvict(h);
+        uint32_t wrap = HISTORY_WRAP;
+        memcpy(h->data + pos, &wrap, sizeof(wrap));
+        hh->head += hh->data_size - pos;
+        pos = 0;
+        if (hh->count == 0) hh->tail = hh->head;
+    }
+    while (hh->count > 0 && (hh->head + size - hh->tail > hh->data_size || hh->count >= SHELL_HISTORY_MAX)) historyEvict(h);
+    if (hh->count == 0) hh->tail = hh->head;
+
+    memcpy(h->data + pos, &len, sizeof(len));
+    memcpy(h->data + pos + sizeof(len), uinput, len + 1);
+    hh->head += size;
+    hh->count++;
+    hh->total++;
+
+    if (h->offsets != NULL) historyIndexUpdate(h); // index in use, keep it up to date
+    if (h->fd != -1) flock(h->fd, LOCK_UN);
+}
+
+// print the last n commands (all if n <= 0), oldest first
+void printHistory(history_t *h, int n) {
+    uint64_t offset, number, skip;
+    const char *cmd;
+    if (h->fd != -1) flock(h->fd, LOCK_SH); // writers of other shells hold LOCK_EX
+    offset = h->header->tail;
+    number = h->header->total - h->header->count;
+    skip = (n > 0 && (uint64_t)n < h->header->count) ? h->header->count - n : 0;
+    while ((cmd = historyNext(h, &offset)) != NULL) {
+        number++;
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        printf("  %lu\t%s\n", (unsigned long)number, cmd);
+    }
+    if (h->fd != -1) flock(h->fd, LOCK_UN);
+}
+
+// history the history builtin works on: the LOCAL shell's, or the one of the session being served
+history_t *shell_history = NULL;
+
+// history [n] | history -s pattern
+int builtinHistory(int argc, char *const argv[]) {
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        // the words of the pattern are searched as one string
+        size_t len = 0;
+        int i, status;
+        for (i = 2; i < argc; i++) len += strlen(argv[i]) + 1;
+        char *pattern = malloc(len);
+        if (pattern == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            return 1;
+        }
+        pattern[0] = '\0';
+        for (i = 2; i < argc; i++) {
+            if (i > 2) strcat(pattern, " ");
+            strcat(pattern, argv[i]);
+        }
+        status = searchHistory(shell_history, pattern);
+        free(pattern);
+        return status;
+    }
+    printHistory(shell_history, (argc > 1) ? atoi(argv[1]) : 0);
+    return 0;
+}
+
+// unmap the history (the file keeps it)
+void freeHistory(history_t *h) {
+    historyIndexFree(h);
+    munmap(h->header, h->map_size);
+    if (h->fd != -1) close(h->fd);
+}
+
+// --------------------------------------
+// server metrics ("stats", SIGUSR1, -m)
+// --------------------------------------
+
+#define STATS_BUCKETS 40 // log2 buckets: (2^(i-1), 2^i], the first one is [0, 1]
+
+// histogram with power-of-two buckets (one increment per value)
+typedef struct {
+    unsigned long count[STATS_BUCKETS];
+    unsigned long n;
+    double sum;
+} histogram_t;
+
+// counters of the server (updated on the hot path, formatted only when read)
+typedef struct {
+    double started;                     // clockSeconds() on startup
+    unsigned long connections_accepted;
+    unsigned long connections_open;
+    unsigned long sessions_open;
+    unsigned long commands;             // command frames executed (built-ins included)
+    unsigned long jobs;                 // command lines executed as jobs
+    unsigned long syntax_errors;
+    unsigned long spawn_failures;       // pipelines that couldn't start all of their stages
+    unsigned long long bytes_relayed;   // output payload sent to clients
+    histogram_t first_byte_us;          // accept to the first byte sent to the client
+    histogram_t command_us;             // job start to job end
+    histogram_t relay_bytes_per_sec;    // output throughput of jobs
+} stats_t;
+
+void histogramAdd(histogram_t *h, double value) {
+    unsigned long long ceiling = (unsigned long long)value + ((value > (unsigned long long)value) ? 1 : 0);
+    int bucket = (ceiling <= 1) ? 0 : 64 - __builtin_clzll(ceiling - 1);
+    if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+    h->count[bucket]++;
+    h->n++;
+    h->sum += value;
+}
+
+// histogram in the text exposition format (cumulative buckets up to the highest used one)
+void histogramFormat(int fd, const char *name, const histogram_t *h) {
+    unsigned long cumulative = 0;
+    int i, last = 0;
+    for (i = 0; i < STATS_BUCKETS; i++) if (h->count[i] > 0) last = i;
+    for (i = 0; i <= last && h->n > 0; i++) {
+        cumulative += h->count[i];
+        dprintf(fd, "seehell_%s_bucket{le=\"%llu\"} %lu\n", name, 1ULL << i, cumulative);
+    }
+    dprintf(fd, "seehell_%s_bucket{le=\"+Inf\"} %lu\n", name, h->n);
+    dprintf(fd, "seehell_%s_sum %.0f\n", name, h->sum);
+    dprintf(fd, "seehell_%s_count %lu\n", name, h->n);
+}
+
+// all metrics as "name value" lines
+void statsFormat(int fd, const stats_t *st) {
+    dprintf(fd, "seehell_uptime_seconds %.3f\n", clockSeconds() - st->started);
+    dprintf(fd, "seehell_connections_accepted_total %lu\n", st->connections_accepted);
+    dprintf(fd, "seehell_connections_open %lu\n", st->connections_open);
+    dprintf(fd, "seehell_sessions_open %lu\n", st->sessions_open);
+    dprintf(fd, "seehell_commands_total %lu\n", st->commands);
+    dprintf(fd, "seehell_jobs_total %lu\n", st->jobs);
+    dprintf(fd, "seehell_syntax_errors_total %lu\n", st->syntax_errors);
+    dprintf(fd, "seehell_spawn_failures_total %lu\n", st->spawn_failures);
+    dprintf(fd, "seehell_relayed_bytes_total %llu\n", st->bytes_relayed);
+    histogramFormat(fd, "first_byte_us", &(st->first_byte_us));
+    histogramFormat(fd, "command_duration_us", &(st->command_us));
+    histogramFormat(fd, "relay_bytes_per_second", &(st->relay_bytes_per_sec));
+}
+
+// metrics the stats builtin prints (the SERVER's, NULL in LOCAL)
+stats_t *shell_stats = NULL;
+
+// stats
+int builtinStats(int argc, char *const argv[]) {
+    (void)argc; (void)argv;
+    if (shell_stats == NULL) {
+        fprintf(stderr, "stats: metrics are kept by the SERVER only\n");
+        return 1;
+    }
+    fflush(stdout);
+    statsFormat(STDOUT_FILENO, shell_stats);
+    return 0;
+}
+
+// --------------------------------------
+// event-driven (epoll) multi-client server
+// --------------------------------------
+
+#define JOB_STDOUT 0
+#define JOB_STDERR 1
+#define JOB_BG_STDOUT 2                 // output of the background jobs of the session
+#define JOB_BG_STDERR 3
+#define JOB_PIPES 4
+
+typedef struct session session_t;
+
+// per-connection state (the sessions share its socket and output buffer)
+typedef struct {
+    int fd;                             // data socket (non-blocking)
+    char *in;                           // received frames not yet handed to their sessions
+    int in_len;
+    int in_size;                        // grown for a longer command frame (up to shellLineMax())
+    char closing;                       // close the connection once the pending output is sent
+    char *out;                          // pending output frames of all sessions (not yet written to the socket)
+    int out_len;
+    int out_sent;
+    int out_size;
+    int splice_fd;                      // job pipe the payload of the current output frame is spliced from
+    int splice_left;                    // payload bytes of that frame still in the pipe
+    int splice_at;                      // position in out where the spliced payload belongs
+    unsigned int events;                // epoll events currently registered for fd
+    double accepted;                    // clockSeconds() on accept, 0 once the first byte was sent
+    session_t *sessions;                // open sessions (protocol.h)
+    int sessions_count;
+} conn_t;
+
+// shell session of a connection: its own working directory, history, background jobs and running command
+struct session {
+    conn_t *conn;
+    uint16_t id;                        // session id of the frames (protocol.h)
+    int cwd;                            // working directory (O_PATH descriptor), entered before the session runs anything
+    history_t history;                  // commands of the session (in memory)
+    vars_t vars;                        // variables of the session (PWD, exported and not)
+    char *in;                           // command frames of the session not yet executed
+    int in_len;
+    int in_size;                        // grown as frames queue up (up to SHELL_SESSION_QUEUE_MAX, or one longer frame)
+    char *line;                         // command line of the running job
+    int line_size;
+    arena_t arena;                      // parsed command line of the running job
+    pipeline_t *job_next;               // pipeline after ';' still to be started
+    pid_t *pids;                        // stages of the running pipeline (reaped ones are set to -1)
+    int pids_count;
+    int pids_size;
+    int pids_running;
+    uint16_t request;                   // id of the command being answered (protocol.h)
+    int job_status;                     // wait status of the last stage
+    int last_status;                    // exit status of the previous command ("$?" of the session)
+    double job_start;                   // clockSeconds() when the job started
+    long long relayed;                  // output payload framed for the current response
+    usage_t job_usage;                  // resource usage of the finished stages
+    char job_timed;                     // a pipeline of the job had "time", their usage is sent after its output
+    char job_timing;                    // the running pipeline has "time"
+    double time_start;                  // clockSeconds() when it started
+    usage_t time_usage;                 // usage of the timed pipelines
+    int job_pipe[JOB_PIPES][2];         // {stdout, stderr, bg stdout, bg stderr} x {read, write} pipes of the job stages
+    unsigned int job_events[JOB_PIPES]; // epoll events currently registered for the job pipes
+    jobs_t jobs;                        // background jobs ('&')
+    int job_wait;                       // "wait"/"fg" of the job in progress: job id, -1 for all jobs, 0 if none
+    char busy;                          // a job is running, further commands wait in the buffer
+    char job_done;                      // all stages finished, only the rest of the output is left
+    char job_drain;                     // the next pipeline (a builtin) waits until the job pipes are empty
+    session_t *next;                    // next session of the connection
+};
+
+// owner of a descriptor the server polls
+typedef struct {
+    conn_t *conn;                       // connection of the data socket or of the session
+    session_t *session;                 // session of a job pipe, NULL for the data socket
+} owner_t;
+
+// server-wide state
+typedef struct {
+    int s;                              // listening socket
+    int epfd;                           // epoll instance
+    int sigfd;                          // SIGCHLD signalfd
+    int sstdout;                        // saved stdout of the server (logging)
+    int stdout_read[2];                 // memfds the server's own {stdout, stderr} are redirected into
+    owner_t *owners;                    // lookup by fd (data sockets and job pipes)
+    int owners_size;
+    int cwd;                            // starting directory of new sessions (O_PATH descriptor)
+    session_t *cwd_session;             // session whose working directory the server is in
+    unsigned int cwd_changes;           // shell_cwd_changes when a session's directory was last saved
+    char relay_splice;                  // job output is moved to sockets with splice (zero-copy)
+    char nodelay;                       // data sockets are TCP, frames are sent without Nagle's delay
+    int timerfd;                        // periodic metrics dump (-m), -1 if disabled
+    stats_t stats;
+} server_t;
+
+// register the owner of fd for lookups from epoll events (session NULL for the data socket of cn)
+char serverMap(server_t *sv, int fd, conn_t *cn, session_t *c) {
+    if (fd >= sv->owners_size) {
+        int size = fd + 64;
+        owner_t *grown = realloc(sv->owners, size * sizeof(owner_t));
+        if (grown == NULL) return 1;
+        memset(grown + sv->owners_size, 0, (size - sv->owners_size) * sizeof(owner_t));
+        sv->owners = grown;
+        sv->owners_size = size;
+    }
+    sv->owners[fd].conn = cn;
+    sv->owners[fd].session = c;
+    return 0;
+}
+
+// make room for len more bytes of pending output of c
+char connReserve(conn_t *c, int len) {
+    if (c->out_len + len > c->out_size && c->out_sent > 0) {
+        // reuse the already sent part of the buffer first
+        memmove(c->out, c->out + c->out_sent, c->out_len - c->out_sent);
+        c->out_len -= c->out_sent;
+        c->splice_at -= c->out_sent;
+        c->out_sent = 0;
+    }
+    if (c->out_len + len > c->out_size) {
+        int size = c->out_size ? c->out_size : SHELL_USERINPUT_MAX;
+        while (size < c->out_len + len) size *= 2;
+        char *grown = realloc(c->out, size);
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            return 1;
+        }
+        c->out = grown;
+        c->out_size = size;
+    }
+    return 0;
+}
+
+// grow a buffer of c to at least size bytes
+// returns 1 on a memory allocation error
+char connGrow(char **buffer, int *buffer_size, int size) {
+    int grow = (*buffer_size) * 2;
+    while (grow < size) grow *= 2;
+    char *grown = realloc((*buffer), grow);
+    if (grown == NULL) {
+        fprintf(stderr, "Memory allocation error.\n");
+        return 1;
+    }
+    (*buffer) = grown;
+    (*buffer_size) = grow;
+    return 0;
+}
+
+// append a frame of the given session and request to the pending output of cn
+char connFrameTo(conn_t *cn, unsigned char type, unsigned char stream, uint16_t session, uint16_t id, int status, const char *data, int len) {
+    if (connReserve(cn, PROTO_HEADER_SIZE + len) != 0) return 1;
+    protoEncode(cn->out + cn->out_len, type, stream, id, session, status, len);
+    memcpy(cn->out + cn->out_len + PROTO_HEADER_SIZE, data, len);
+    cn->out_len += PROTO_HEADER_SIZE + len;
+    return 0;
+}
+
+// append a frame of the command being answered by c
+char connFrame(session_t *c, unsigned char type, unsigned char stream, int status, const char *data, int len) {
+    return connFrameTo(c->conn, type, stream, c->id, c->request, status, data, len);
+}
+
+// read what is available in fd into output frames of the given stream (tagged with the request id)
+// at most limit bytes of pending output are filled, returns 1 once fd has nothing more (EAGAIN or EOF)
+char connRelay(session_t *c, int fd, unsigned char stream, uint16_t id, int limit) {
+    conn_t *cn = c->conn;
+    int r;
+    while (cn->out_len - cn->out_sent < limit) {
+        // read directly behind a reserved header, the header is filled in afterwards
+        if (connReserve(cn, PROTO_HEADER_SIZE + SHELL_USERINPUT_MAX) != 0) return 0;
+        r = sc_read(fd, cn->out + cn->out_len + PROTO_HEADER_SIZE, SHELL_USERINPUT_MAX);
+        if (r > 0) {
+            protoEncode(cn->out + cn->out_len, PROTO_OUT, stream, id, c->id, 0, r);
+            cn->out_len += PROTO_HEADER_SIZE + r;
+            c->relayed += r;
+            continue;
+        }
+        if (r == -1 && errno == EINTR) continue;
+        return 1; // nothing more for now (EAGAIN) or no writers left (EOF)
+    }
+    return 0;
+}
+
+// move what the server printed into the memfd fd into output frames of the given stream, then empty the memfd
+void connCapture(session_t *c, int fd, unsigned char stream) {
+    conn_t *cn = c->conn;
+    off_t size = lseek(fd, 0, SEEK_CUR); // shared with STDOUT/STDERR, which write at the end
+    off_t offset = 0;
+    ssize_t r;
+    while (offset < size) {
+        int len = (size - offset > PROTO_PAYLOAD_MAX) ? PROTO_PAYLOAD_MAX : size - offset;
+        if (connReserve(cn, PROTO_HEADER_SIZE + len) != 0) break;
+        if ((r = pread(fd, cn->out + cn->out_len + PROTO_HEADER_SIZE, len, offset)) <= 0) {
+            if (r == -1 && errno == EINTR) continue;
+            break;
+        }
+        protoEncode(cn->out + cn->out_len, PROTO_OUT, stream, c->request, c->id, 0, r);
+        cn->out_len += PROTO_HEADER_SIZE + r;
+        c->relayed += r;
+        offset += r;
+    }
+    if (size > 0 && ftruncate(fd, 0) != 0) perror("capture");
+    lseek(fd, 0, SEEK_SET);
+}
+
+// move everything the server itself printed (built-ins, prompt, errors) into the pending output of c
+// the server prints into memfds, so a builtin with a large output (set, history) never blocks the server
+void connCaptureStdout(server_t *sv, session_t *c) {
+    fflush(stdout);
+    connCapture(c, sv->stdout_read[JOB_STDOUT], PROTO_STDOUT);
+    connCapture(c, sv->stdout_read[JOB_STDERR], PROTO_STDERR);
+}
+
+// start an output frame whose payload (all that is in the job pipe fd right now) is spliced
+// from the pipe straight into the socket by connFlush, without a copy through the server
+// returns 1 if the pipe is empty
+char connSpliceFrame(session_t *c, int fd, unsigned char stream, uint16_t id) {
+    conn_t *cn = c->conn;
+    int available = 0;
+    if (ioctl(fd, FIONREAD, &available) == -1 || available <= 0) return 1; // empty (or no writers left)
+    if (available > PROTO_PAYLOAD_MAX) available = PROTO_PAYLOAD_MAX;
+    if (connReserve(cn, PROTO_HEADER_SIZE) != 0) return 0;
+    protoEncode(cn->out + cn->out_len, PROTO_OUT, stream, id, c->id, 0, available);
+    cn->out_len += PROTO_HEADER_SIZE;
+    cn->splice_fd = fd;
+    cn->splice_left = available;
+    c->relayed += available;
+    cn->splice_at = cn->out_len;
+    return 0;
+}
+
+// splice is not supported for this socket: read the rest of the spliced payload
+// and put it into the pending output where it belongs (behind its frame header)
+char connSpliceFallback(conn_t *c) {
+    int r;
+    if (connReserve(c, c->splice_left) != 0) return 1;
+    memmove(c->out + c->splice_at + c->splice_left, c->out + c->splice_at, c->out_len - c->splice_at);
+    c->out_len += c->splice_left;
+    while (c->splice_left > 0) {
+        // the payload is already in the pipe, this doesn't block
+        if ((r = sc_read(c->splice_fd, c->out + c->splice_at, c->splice_left)) <= 0) {
+            if (r == -1 && errno == EINTR) continue;
+            return 1;
+        }
+        c->splice_at += r;
+        c->splice_left -= r;
+    }
+    return 0;
+}
+
+// move the available output of the running job into the pending output of c (streamed as it comes)
+// reading stops at SHELL_CONN_OUTPUT_MAX pending bytes, so a slow client makes the stages block
+// on a full pipe instead of growing the buffer (backpressure)
+// with splice, one frame (of any session of the connection) is relayed at a time and only its header passes through the server
+// output of background jobs is relayed as well (between responses too), it doesn't hold up the running job
+// returns 1 once both job pipes are empty
+char connJobOutput(server_t *sv, session_t *c) {
+    int i;
+    if (sv->relay_splice) {
+        if (c->conn->splice_left > 0) return 0; // previous frame still being spliced
+        if (!connSpliceFrame(c, c->job_pipe[JOB_STDOUT][PIPE_READ], PROTO_STDOUT, c->request)) return 0;
+        if (!connSpliceFrame(c, c->job_pipe[JOB_STDERR][PIPE_READ], PROTO_STDERR, c->request)) return 0;
+        if (c->job_pipe[JOB_BG_STDOUT][PIPE_READ] != -1 && connSpliceFrame(c, c->job_pipe[JOB_BG_STDOUT][PIPE_READ], PROTO_STDOUT, 0))
+            connSpliceFrame(c, c->job_pipe[JOB_BG_STDERR][PIPE_READ], PROTO_STDERR, 0);
+        return 1;
+    }
+    for (i = JOB_BG_STDOUT; i <= JOB_BG_STDERR; i++)
+        if (c->job_pipe[i][PIPE_READ] != -1) connRelay(c, c->job_pipe[i][PIPE_READ], (i == JOB_BG_STDOUT) ? PROTO_STDOUT : PROTO_STDERR, 0, SHELL_CONN_OUTPUT_MAX);
+    char empty = connRelay(c, c->job_pipe[JOB_STDOUT][PIPE_READ], PROTO_STDOUT, c->request, SHELL_CONN_OUTPUT_MAX);
+    return connRelay(c, c->job_pipe[JOB_STDERR][PIPE_READ], PROTO_STDERR, c->request, SHELL_CONN_OUTPUT_MAX) && empty;
+}
+
+// register the epoll events c (and the job pipes of its sessions) is currently interested in
+void connEvents(server_t *sv, conn_t *c) {
+    struct epoll_event ev;
+    unsigned int events = 0;
+    session_t *se;
+    int i;
+    if (!c->closing && c->in_len < c->in_size) events |= EPOLLIN; // stop reading if the input buffer is full
+    if (c->out_sent < c->out_len || c->splice_left > 0) events |= EPOLLOUT;
+    if (events != c->events) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = c->fd;
+        epoll_ctl(sv->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+
+    // job output is only read while there is room for it (and no frame is being spliced)
+    events = (c->out_len - c->out_sent < SHELL_CONN_OUTPUT_MAX && c->splice_left == 0) ? EPOLLIN : 0;
+    for (se = c->sessions; se != NULL; se = se->next) {
+        for (i = JOB_STDOUT; i < JOB_PIPES; i++) {
+            if (se->job_pipe[i][PIPE_READ] == -1 || events == se->job_events[i]) continue;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = events;
+            ev.data.fd = se->job_pipe[i][PIPE_READ];
+            epoll_ctl(sv->epfd, EPOLL_CTL_MOD, se->job_pipe[i][PIPE_READ], &ev);
+            se->job_events[i] = events;
+        }
+    }
+}
+
+// release the job pipes from..to of c
+// a frame still being spliced from one of them is read into the pending output first, the frames behind it
+// (of any session of the connection) would be spliced from a closed or reused descriptor otherwise
+void connPipesClose(server_t *sv, session_t *c, int from, int to) {
+    conn_t *cn = c->conn;
+    int i;
+    for (i = from; i <= to; i++) {
+        if (c->job_pipe[i][PIPE_READ] != -1 && cn->splice_left > 0 && cn->splice_fd == c->job_pipe[i][PIPE_READ]) {
+            if (connSpliceFallback(cn) != 0) dprintf(sv->sstdout, ">> client %d: job output lost\n", cn->fd);
+            cn->splice_left = 0; // the payload has its place in the output either way
+        }
+        if (c->job_pipe[i][PIPE_READ] != -1) {
+            epoll_ctl(sv->epfd, EPOLL_CTL_DEL, c->job_pipe[i][PIPE_READ], NULL);
+            serverMap(sv, c->job_pipe[i][PIPE_READ], NULL, NULL);
+            close(c->job_pipe[i][PIPE_READ]); c->job_pipe[i][PIPE_READ] = -1;
+        }
+        if (c->job_pipe[i][PIPE_WRITE] != -1) {
+            close(c->job_pipe[i][PIPE_WRITE]); c->job_pipe[i][PIPE_WRITE] = -1;
+        }
+    }
+}
+
+// create the job pipes from..to of c (those not open yet), the write ends are given to the stages as STDOUT and STDERR
+// only the read ends are non-blocking (children expect blocking output)
+// returns 1 on error (the pipes are released)
+char connPipesOpen(server_t *sv, session_t *c, int from, int to) {
+    struct epoll_event ev;
+    int i;
+    for (i = from; i <= to; i++) {
+        if (c->job_pipe[i][PIPE_READ] != -1) continue;
+        if (sc_pipe2(c->job_pipe[i], O_CLOEXEC) != 0) {
+            perror("Job pipe error");
+            c->job_pipe[i][PIPE_READ] = c->job_pipe[i][PIPE_WRITE] = -1;
+            break;
+        }
+        fcntl(c->job_pipe[i][PIPE_READ], F_SETFL, fcntl(c->job_pipe[i][PIPE_READ], F_GETFL) | O_NONBLOCK);
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->job_events[i] = EPOLLIN;
+        ev.data.fd = c->job_pipe[i][PIPE_READ];
+        if (serverMap(sv, c->job_pipe[i][PIPE_READ], c->conn, c) != 0 || epoll_ctl(sv->epfd, EPOLL_CTL_ADD, c->job_pipe[i][PIPE_READ], &ev) != 0) {
+            perror("Job pipe error");
+            break;
+        }
+    }
+    if (i <= to) {
+        connPipesClose(sv, c, from, to);
+        return 1;
+    }
+    return 0;
+}
+
+// release the pipes of the running job of c
+void connJobClose(server_t *sv, session_t *c) {
+    connPipesClose(sv, c, JOB_STDOUT, JOB_STDERR);
+}
+
+// open a session of the connection (in the server's starting directory, see serveConnections)
+// returns NULL on error
+session_t *sessionOpen(server_t *sv, conn_t *cn, uint16_t id) {
+    session_t *c = calloc(1, sizeof(session_t));
+    int i;
+    if (c == NULL) return NULL;
+    c->conn = cn;
+    c->id = id;
+    c->in_size = PROTO_HEADER_SIZE + SHELL_USERINPUT_MAX;
+    c->line_size = SHELL_USERINPUT_MAX;
+    c->in = malloc(c->in_size);
+    c->line = malloc(c->line_size);
+    c->cwd = fcntl(sv->cwd, F_DUPFD_CLOEXEC, 0);
+    if (c->in == NULL || c->line == NULL || c->cwd == -1 || varsCopy(&(c->vars), &vars_env) != 0
+        || allocHistory(&(c->history), 0) != 0) {
+        varsFree(&(c->vars));
+        if (c->cwd != -1) close(c->cwd);
+        free(c->in);
+        free(c->line);
+        free(c);
+        return NULL;
+    }
+    for (i = JOB_STDOUT; i < JOB_PIPES; i++) c->job_pipe[i][PIPE_READ] = c->job_pipe[i][PIPE_WRITE] = -1;
+    c->next = cn->sessions;
+    cn->sessions = c;
+    cn->sessions_count++;
+    sv->stats.sessions_open++;
+    return c;
+}
+
+// session of the connection with the given id, NULL if it isn't open
+session_t *sessionFind(conn_t *cn, uint16_t id) {
+    session_t *c;
+    for (c = cn->sessions; c != NULL && c->id != id; c = c->next);
+    return c;
+}
+
+// close the session, its running job stages (and background jobs) are left to finish and get reaped without an owner
+void sessionClose(server_t *sv, session_t *c) {
+    session_t **at;
+    for (at = &(c->conn->sessions); (*at) != c; at = &((*at)->next));
+    (*at) = c->next;
+    c->conn->sessions_count--;
+    sv->stats.sessions_open--;
+    sv->stats.bytes_relayed += c->relayed;
+    if (sv->cwd_session == c) sv->cwd_session = NULL;
+    connPipesClose(sv, c, JOB_STDOUT, JOB_BG_STDERR);
+    jobsFree(&(c->jobs));
+    arenaFree(&(c->arena));
+    freeHistory(&(c->history));
+    if (shell_vars == &(c->vars)) shell_vars = &vars_env;
+    varsFree(&(c->vars));
+    close(c->cwd);
+    free(c->pids);
+    free(c->in);
+    free(c->line);
+    free(c);
+}
+
+// make the working directory of c the server's (commands, builtins and globs of c run in it)
+void sessionEnter(server_t *sv, session_t *c) {
+    char cwd[PATH_MAX];
+    shell_history = &(c->history); // history, jobs, wait, ... builtins
+    shell_jobs = &(c->jobs);
+    shell_vars = &(c->vars);
+    if (sv->cwd_session == c) return;
+    if (fchdir(c->cwd) != 0) perror("Session directory error");
+    if (getcwd(cwd, sizeof(cwd)) != NULL) varSet("PWD", cwd, 0);
+    sv->cwd_session = c;
+}
+
+// remember the working directory the server is in as the one of c (after cd)
+void sessionSaveCwd(server_t *sv, session_t *c) {
+    int fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Session directory error");
+        return;
+    }
+    close(c->cwd);
+    c->cwd = fd;
+    sv->cwd_session = c;
+}
+
+// close the connection with all its sessions
+void connClose(server_t *sv, conn_t *c) {
+    dprintf(sv->sstdout, ">> client %d disconnected\n", c->fd);
+    sv->stats.connections_open--;
+    epoll_ctl(sv->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    serverMap(sv, c->fd, NULL, NULL);
+    close(c->fd);
+    c->splice_left = 0; // nothing is sent anymore
+    while (c->sessions != NULL) sessionClose(sv, c->sessions);
+    free(c->out);
+    free(c->in);
+    free(c);
+}
+
+// write as much of the pending output as the socket accepts
+// returns 1 if the connection got closed
+char connFlush(server_t *sv, conn_t *c) {
+    ssize_t w;
+    while (c->out_sent < c->out_len || c->splice_left > 0) {
+        if (c->splice_left > 0 && c->out_sent == c->splice_at) {
+            // payload of the current frame goes from the job pipe to the socket directly
+            w = splice(c->splice_fd, NULL, c->fd, NULL, c->splice_left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (w == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                dprintf(sv->sstdout, "splice not supported, relaying job output through buffers\n");
+                sv->relay_splice = 0;
+                if (connSpliceFallback(c) == 0) continue;
+            }
+            if (w == 0) break; // can't happen while the payload is in the pipe, but never spin on it
+            if (w > 0) c->splice_left -= w;
+        } else {
+            // MSG_NOSIGNAL: a client that went away must not kill the server with SIGPIPE
+            // MSG_MORE: a header waiting for its spliced payload shouldn't leave in a packet of its own
+            int end = (c->splice_left > 0) ? c->splice_at : c->out_len;
+            w = send(c->fd, c->out + c->out_sent, end - c->out_sent, MSG_NOSIGNAL | ((end == c->splice_at && c->splice_left > 0) ? MSG_MORE : 0));
+            if (w > 0) c->out_sent += w;
+        }
+        if (w > 0 && c->accepted != 0) {
+            histogramAdd(&(sv->stats.first_byte_us), (clockSeconds() - c->accepted) * 1e6);
+            c->accepted = 0;
+        }
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            dprintf(sv->sstdout, "data socket write: %s\n", strerror(errno));
+            connClose(sv, c);
+            return 1;
+        }
+    }
+    if (c->out_sent == c->out_len && c->splice_left == 0) {
+        c->out_sent = c->out_len = 0;
+        if (c->closing) {
+            connClose(sv, c);
+            return 1;
+        }
+    }
+    connEvents(sv, c);
+    return 0;
+}
+
+// end of the response to a command: its exit status and server's prompt for the client
+void connRespond(server_t *sv, session_t *c, int status) {
+    char prompt[PROMPT_MAX];
+    int len;
+    jobsNotify(&(c->jobs), 1);
+    connCaptureStdout(sv, c);
+    sv->stats.bytes_relayed += c->relayed;
+    c->relayed = 0;
+    len = formatPrompt(prompt, sizeof(prompt));
+    connFrame(c, PROTO_END, PROTO_STDOUT, status, prompt, len);
+    c->last_status = status;
+}
+
+// the output of the job's pipelines so far is all framed into the pending output of its connection
+char connJobDrained(session_t *c) {
+    int i, available;
+    for (i = JOB_STDOUT; i <= JOB_STDERR; i++) {
+        if (c->conn->splice_left > 0 && c->conn->splice_fd == c->job_pipe[i][PIPE_READ]) return 0;
+        if (ioctl(c->job_pipe[i][PIPE_READ], FIONREAD, &available) == 0 && available > 0) return 0;
+    }
+    return 1;
+}
+
+// end the "wait" or "fg" of the job of c once the background jobs it waits for are done
+// its exit status becomes the one of the pipeline
+// returns 1 if the wait ended (the job can go on)
+char connJobWaited(session_t *c) {
+    job_t *job, *next;
+    int status = 0;
+    for (job = c->jobs.head; job != NULL; job = job->next)
+        if ((c->job_wait == -1 || job->id == c->job_wait) && job->running > 0) return 0;
+    for (job = c->jobs.head; job != NULL; job = next) {
+        next = job->next;
+        if (job->id == c->job_wait) status = exitStatus(job->status);
+        if (job->id == c->job_wait || (c->job_wait == -1 && job->running == 0)) jobRemove(&(c->jobs), job);
+    }
+    c->job_wait = 0;
+    c->job_status = status << 8;
+    return 1;
+}
+
+// start the next pipeline of the running job of c
+// once there is nothing left to run, the job is marked as done and its pipes lose the last writer
+void connJobNext(server_t *sv, session_t *c) {
+    sessionEnter(sv, c);
+    while (c->job_next != NULL && c->job_wait == 0) {
+        shell_status = exitStatus(c->job_status); // "$?" of the pipeline
+        if (pipelineExpand(&(c->arena), c->job_next) != 0) {
+            c->job_status = 1 << 8;
+            c->job_next = c->job_next->next;
+            continue;
+        }
+        char timed = pipelineTimed(c->job_next);
+        cmd_t *cmd = c->job_next->stages;
+        if (timed) c->job_timed = 1;
+        if (c->job_next->background) {
+            // output of background jobs goes into pipes of their own, kept until the connection closes
+            c->job_status = 0;
+            if (connPipesOpen(sv, c, JOB_BG_STDOUT, JOB_BG_STDERR) != 0
+                || jobStart(&(c->jobs), c->job_next, c->line,
+                            c->job_pipe[JOB_BG_STDOUT][PIPE_WRITE], c->job_pipe[JOB_BG_STDERR][PIPE_WRITE]) == NULL) {
+                sv->stats.spawn_failures++;
+                c->job_status = 1 << 8;
+            }
+            c->job_next = c->job_next->next;
+            continue;
+        }
+        if (c->job_next->count == 1 && cmd->argc > 0 && (strcmp(cmd->argv[0], "wait") == 0 || strcmp(cmd->argv[0], "fg") == 0)) {
+            // the job goes on once the background jobs are done (connJobWaited), other sessions are served meanwhile
+            char all;
+            job_t *job = jobsTarget(&(c->jobs), (cmd->argc > 1) ? cmd->argv[1] : "", cmd->argv[0][0] == 'f', &all);
+            c->job_next = c->job_next->next;
+            if (job == NULL && !all) c->job_status = 127 << 8;
+            else {
+                c->job_wait = all ? -1 : job->id;
+                connJobWaited(c); // at once if there is nothing to wait for
+            }
+            continue;
+        }
+        if (builtinInShell(c->job_next) && !connJobDrained(c)) {
+            // output of the pipelines before it is still in the job pipes, the builtin's would overtake it
+            c->job_drain = 1;
+            break;
+        }
+        if (builtinInProcess(c->job_next, &(c->job_status))) { // cd, echo, export, ...
+            if (sv->cwd_changes != shell_cwd_changes) { // cd moves only this session
+                sv->cwd_changes = shell_cwd_changes;
+                sessionSaveCwd(sv, c);
+            }
+            c->job_next = c->job_next->next;
+            continue;
+        }
+        if (startPipeline(c->job_next,
+                          c->job_pipe[JOB_STDOUT][PIPE_WRITE], c->job_pipe[JOB_STDERR][PIPE_WRITE],
+                          &(c->pids), &(c->pids_count), &(c->pids_size)) != 0) sv->stats.spawn_failures++;
+        c->job_next = c->job_next->next;
+        c->pids_running = c->pids_count;
+        c->job_timing = timed;
+        c->time_start = clockSeconds();
+        if (c->pids_running > 0) break; // wait for the pipeline (reaped on SIGCHLD)
+    }
+    connCaptureStdout(sv, c); // pipe and fork errors are printed by the server itself
+    if (c->pids_running == 0 && c->job_wait == 0 && !c->job_drain) {
+        c->job_done = 1;
+        close(c->job_pipe[JOB_STDOUT][PIPE_WRITE]); c->job_pipe[JOB_STDOUT][PIPE_WRITE] = -1;
+        close(c->job_pipe[JOB_STDERR][PIPE_WRITE]); c->job_pipe[JOB_STDERR][PIPE_WRITE] = -1;
+    }
+}
+
+// forward the output of the running job of c, end the job once it is done and its output is sent
+// returns 1 if the job ended (the response including the prompt is pending)
+char connJobPump(server_t *sv, session_t *c) {
+    if (!connJobOutput(sv, c)) return 0;
+    if (c->job_drain) { // the output before the waiting builtin is framed, the job goes on
+        c->job_drain = 0;
+        connJobNext(sv, c);
+        if (!connJobOutput(sv, c)) return 0;
+    }
+    if (!c->job_done) return 0;
+    connJobClose(sv, c);
+    arenaReset(&(c->arena));
+    c->busy = 0;
+    c->job_done = 0;
+    c->job_usage.real = clockSeconds() - c->job_start;
+    histogramAdd(&(sv->stats.command_us), c->job_usage.real * 1e6);
+    if (c->relayed > 0 && c->job_usage.real > 0) histogramAdd(&(sv->stats.relay_bytes_per_sec), c->relayed / c->job_usage.real);
+    if (c->job_timed || shell_timing) {
+        char line[256];
+        int len;
+        if (shell_timing) {
+            usageFormat(line, sizeof(line), &(c->job_usage));
+            dprintf(sv->sstdout, ">> client %d/%u: [time] %s\n", c->conn->fd, c->id, line);
+        }
+        if (c->job_timed) { // the timed pipelines of the line together
+            len = usageFormat(line, sizeof(line) - 1, &(c->time_usage));
+            line[len++] = '\n';
+            connFrame(c, PROTO_OUT, PROTO_STDERR, 0, line, len);
+        }
+    }
+    connRespond(sv, c, exitStatus(c->job_status));
+    return 1;
 }
 
-// gets the prompt using syscalls roughly as follows: TIME GETPWUID(GETUID)@HOSTNAME:
-void printPrompt() {
-    // unix time
-    time_t utime[1];
-    utime[0] = sc_time();
+// start executing the command line as the job of c
+void connJobStart(server_t *sv, session_t *c) {
+    char error;
 
-    // human readable time
-    struct tm *htime;
-    htime = localtime(utime);
+    // the whole line is parsed before anything runs, a syntax error only gets a response
+    c->job_next = parseLine(&(c->arena), c->line, &error);
+    if (error) {
+        sv->stats.syntax_errors++;
+        arenaReset(&(c->arena));
+        connRespond(sv, c, 2);
+        return;
+    }
 
-    // user name
-    char *name = getpwuid(sc_getuid())->pw_name;
-    
-    // host name
-    char hostname[PROMPT_HOSTNAME_MAX];
-    gethostname(hostname, PROMPT_HOSTNAME_MAX);
+    // job output pipes
+    if (connPipesOpen(sv, c, JOB_STDOUT, JOB_STDERR) != 0) {
+        arenaReset(&(c->arena));
+        connRespond(sv, c, 1);
+        return;
+    }
 
-    // build and output an up-to-date prompt
-    printf("%02d:%02d %s@%s%c ", 
-        htime->tm_hour, 
-        htime->tm_min,
-        name,
-        hostname,
-        PROMPT_DELIMITER
-        );
+    c->busy = 1;
+    c->job_status = c->last_status << 8; // "$?" of the first pipeline
+    c->job_timed = c->job_timing = c->job_drain = 0;
+    memset(&(c->job_usage), 0, sizeof(usage_t));
+    memset(&(c->time_usage), 0, sizeof(usage_t));
+    c->job_start = clockSeconds();
+    sv->stats.jobs++;
+    connJobNext(sv, c);
+    connJobPump(sv, c);
 }
 
-// remove spaces from the left
-char *ltrim(char* str) {
-    while((*str) == ' ') str++;
-    return str;
-}
+// execute the complete command frames queued for session c (one at a time, the next after the job ends)
+// a PROTO_CLOSE frame closes the session once the commands before it are done
+void sessionProcess(server_t *sv, session_t *c) {
+    proto_header_t header;
+    while (!c->busy && c->job_wait == 0 && !c->conn->closing && c->in_len >= PROTO_HEADER_SIZE) {
+        protoDecode(c->in, &header); // only whole frames are queued (connProcess)
+        if ((int)header.length >= c->line_size && connGrow(&(c->line), &(c->line_size), header.length + 1) != 0) return;
+        memcpy(c->line, c->in + PROTO_HEADER_SIZE, header.length);
+        c->line[header.length] = '\0';
+        c->request = header.id; // every frame of the response is tagged with it
+        c->in_len -= PROTO_HEADER_SIZE + header.length;
+        memmove(c->in, c->in + PROTO_HEADER_SIZE + header.length, c->in_len);
+        if (header.type == PROTO_CLOSE) {
+            dprintf(sv->sstdout, ">> client %d/%u: session closed\n", c->conn->fd, c->id);
+            connFrame(c, PROTO_END, PROTO_STDOUT, 0, "", 0);
+            sessionClose(sv, c);
+            return;
+        }
 
-// remove spaces from the right
-char *rtrim(char* str) {
-    char *end = str + strlen(str);
-    while((*(--end)) == ' ');
-    *(++end) = '\0';
-    return str;
-}
+        // request handling
+        dprintf(sv->sstdout, ">> client %d/%u: %s\n", c->conn->fd, c->id, c->line);
+        sv->stats.commands++;
 
-// remove spaces from both left and right
-char *trim(char* str) {
-    return ltrim(rtrim(str)); 
-}
+        // -------------
+        // server action (different than local)
+        // -------------
 
-// set the current working directory
-// verifiable using external ls or pwd
-void changedir(char* arg) {
-    // check for input and trim arg
-    // also if no input => cd to HOME directory
-    if (arg == NULL || (arg = trim(arg))[0] == '\0') {
-        char *homedir = getpwuid(sc_getuid())->pw_dir;
-        // printf("[%s]\n", homedir);
-        if (chdir(homedir) != 0) perror("cd error");
-    } else {
-        // process the user input as a directory location
-        // printf("[%s]\n", arg);
-        if (chdir(arg) != 0) perror("cd error");
+        // shell control (the other builtins are found in any stage of the line, see builtins)
+        char *uinput = trim(c->line);
+        pushHistory(&(c->history), uinput);
+        // no support for halt (reserved for client-only)
+        if (strcmp(uinput, "quit") == 0) { // quit (client sends quit to server, server closes the connection it came from)
+            c->conn->closing = 1;
+            connCaptureStdout(sv, c);
+        }
+        else if (uinput[0] == '\0') connRespond(sv, c, 0); // nothing to execute, just respond with a prompt
+        else connJobStart(sv, c); // command execution (responds once the job ends)
     }
 }
 
-// parse internal user input as arguments for external command execution
-// all parameters except the first are output
-char **parseArgs(char* input, int* _argc, char** _redir_in, char** _redir_out, char* _next_type, char** _next_input) {
-    char **args = NULL;
-    char buffer[SHELL_USERINPUT_MAX];
-    memset(buffer, '\0', sizeof(buffer));
-    
-    (*_redir_in) = NULL;
-    (*_redir_out) = NULL;
-    (*_next_type) = PARG_NTYPE_FINISHED;
-    (*_next_input) = NULL;
-    
-    char *bp = NULL;
-    char *ip = NULL;
-    char **ap = NULL;
-    char quote = 0;
-    char waschar = 0;
-    char escaped = 0;
-    char commented = 0;
-    char redirected = 0;
-    char nextarg = 0;
-    char **redir;
-    int count = 0;
-
-    // count the number of arguments
-    ip = input;
-    ip--;
-    while((*++ip) != '\0' && !commented && !nextarg) {
-        switch(*ip) {
-            case '\\':
-                if (!escaped) {
-                    escaped = 1;
-                    continue;
-                }
-            case ';':
-            case '|':
-                if (!escaped) {
-                    nextarg = 1;
-                    continue;
-                }
-            case '<':
-            case '>':
-                if (!escaped) {
-                    redirected = 1;
-                    continue;
+// hand the complete frames received on c to their sessions (a command for a new session id opens it)
+// and execute what the sessions can run, until no more frames can be handed over
+// the queue of a busy session grows, so the frames of the other sessions behind it are still handed over,
+// only frames behind a queue of SHELL_SESSION_QUEUE_MAX stay in c->in (and the socket isn't read meanwhile)
+// returns 1 if the connection got closed
+char connProcess(server_t *sv, conn_t *c) {
+    proto_header_t header;
+    session_t *se, *next;
+    int at;
+    do {
+        at = 0;
+        while (!c->closing && c->in_len - at >= PROTO_HEADER_SIZE) {
+            protoDecode(c->in + at, &header);
+            if ((header.type != PROTO_CMD && header.type != PROTO_CLOSE) || header.length >= (uint32_t)shellLineMax()) {
+                dprintf(sv->sstdout, ">> client %d: protocol error\n", c->fd);
+                connClose(sv, c);
+                return 1;
+            }
+            int size = PROTO_HEADER_SIZE + header.length;
+            if (c->in_len - at < size) { // rest of the frame not received yet
+                // a long command is reassembled across reads, the buffers keep their size for the next ones
+                if (size > c->in_size && connGrow(&(c->in), &(c->in_size), size) != 0) {
+                    connClose(sv, c);
+                    return 1;
                 }
-            case '#':
-                if (!escaped) {
-                    commented = 1;
+                break;
+            }
+            if ((se = sessionFind(c, header.session)) == NULL) {
+                if (header.type == PROTO_CLOSE) { // nothing to close
+                    connFrameTo(c, PROTO_END, PROTO_STDOUT, header.session, header.id, 1, "", 0);
+                    at += size;
                     continue;
                 }
-            case '\"':
-                if (!escaped) {
-                    quote = !quote;
-                    if (quote) continue; // don't count the quote as arg character
+                if (c->sessions_count >= SHELL_SESSIONS_MAX || (se = sessionOpen(sv, c, header.session)) == NULL) {
+                    dprintf(sv->sstdout, ">> client %d: can't open session %u\n", c->fd, header.session);
+                    connClose(sv, c);
+                    return 1;
                 }
-            case ' ':
-                if (!escaped) {
-                    if (!quote && waschar) {
-                        // end of a non-empty argument within or outside quotes
-                        if (!redirected) count++;
-                        waschar = 0;
-                        redirected = 0;
-                        continue;
-                    }
-                    if (!quote) continue; // don't count space outside quotes as arg character
+            }
+            if (se->in_len + size > se->in_size) {
+                if (se->in_len > 0 && se->in_len + size > SHELL_SESSION_QUEUE_MAX) break; // queue of the session is full
+                if (connGrow(&(se->in), &(se->in_size), size) != 0) {
+                    connClose(sv, c);
+                    return 1;
                 }
-            default:
-                // any non-quote characters, except spaces outside quotes
-                waschar = 1;
-                escaped = 0;
+            }
+            memcpy(se->in + se->in_len, c->in + at, size);
+            se->in_len += size;
+            at += size;
         }
+        c->in_len -= at;
+        memmove(c->in, c->in + at, c->in_len);
+        for (se = c->sessions; se != NULL; se = next) {
+            next = se->next;
+            sessionProcess(sv, se);
+        }
+    } while (at > 0 && !c->closing);
+    return connFlush(sv, c);
+}
+
+// read what the client sent
+void connRead(server_t *sv, conn_t *c) {
+    ssize_t r;
+    while (c->in_len < c->in_size) {
+        r = sc_read(c->fd, c->in + c->in_len, c->in_size - c->in_len);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            dprintf(sv->sstdout, "data socket read: %s\n", strerror(errno));
+            connClose(sv, c);
+            return;
+        }
+        if (r == 0) { // client left
+            connClose(sv, c);
+            return;
+        }
+        c->in_len += r;
     }
-    if (quote) {
-        fprintf(stderr, "Matching quote not found.\n");
-        return NULL;
-    }
-    if (waschar) {
-        // if there have been any arguments
-        // count the last unqoted argument in 
-        // quoted args have already been counted on quotes
-        if (!redirected) count++;
-    }
+    connProcess(sv, c);
+}
 
-    // printf("arg count: %d\n", count);
+// accept all pending connections (non-blocking), each starts with session 0
+void serverAccept(server_t *sv) {
+    struct epoll_event ev;
+    int ds;
+    while ((ds = accept4(sv->s, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        conn_t *c = calloc(1, sizeof(conn_t));
+        if (sv->nodelay) setsockopt(ds, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int)); // header and payload leave at once
+        if (c != NULL) {
+            c->in_size = PROTO_HEADER_SIZE + SHELL_USERINPUT_MAX;
+            c->in = malloc(c->in_size);
+        }
+        if (c == NULL || c->in == NULL || serverMap(sv, ds, c, NULL) != 0) {
+            dprintf(sv->sstdout, "Memory allocation error.\n");
+            if (c != NULL) free(c->in);
+            free(c);
+            close(ds);
+            continue;
+        }
+        c->fd = ds;
+        c->events = EPOLLIN;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->events;
+        ev.data.fd = ds;
+        if (epoll_ctl(sv->epfd, EPOLL_CTL_ADD, ds, &ev) != 0) {
+            dprintf(sv->sstdout, "epoll add: %s\n", strerror(errno));
+            serverMap(sv, ds, NULL, NULL);
+            free(c->in);
+            free(c);
+            close(ds);
+            continue;
+        }
+        dprintf(sv->sstdout, ">> client %d connected\n", ds);
+        sv->stats.connections_accepted++;
+        sv->stats.connections_open++;
+        c->accepted = clockSeconds();
 
-    // malloc buffers for the number of arguments
-    // freed outside function after use incl. all children to be malloc'd below
-    args = malloc((count + 1) * sizeof(char*));
-    if (args == NULL) {
-        fprintf(stderr, "Memory allocation error.\n");
-        return NULL;
+        // greet the client with a prompt of session 0
+        session_t *first = sessionOpen(sv, c, 0);
+        if (first == NULL) {
+            dprintf(sv->sstdout, ">> client %d: can't open session 0\n", ds);
+            connClose(sv, c);
+            continue;
+        }
+        connRespond(sv, first, 0);
+        connFlush(sv, c);
     }
-    args[count] = (char *) NULL; // requirement for exec to NULL-terminate the pointer array
-    (*_argc) = count;
-
-    // save the arguments
-    waschar = 0;
-    escaped = 0;
-    commented = 0;
-    redirected = 0;
-    nextarg = 0;
-    bp = buffer;
-    ip = input;
-    ap = args;
-    ip--;
-    while((*++ip) != '\0' && !commented && !nextarg) {
-        switch(*ip) {
-            case '\\':
-                if (!escaped) {
-                    escaped = 1;
-                    continue;
-                }
-            case ';':
-                if (!escaped) {
-                    nextarg = 1;
-                    (*_next_type) = PARG_NTYPE_SEMICOLON;
-                    (*_next_input) = ip + 1;
-                    continue;
-                }
-            case '|':
-                if (!escaped) {
-                    nextarg = 1;
-                    (*_next_type) = PARG_NTYPE_PIPE;
-                    (*_next_input) = ip + 1;
-                    continue;
-                }
-            case '<':
-                if (!escaped) {
-                    redirected = 1;
-                    continue;
-                }
-            case '>':
-                if (!escaped) {
-                    redirected = 2;
-                    continue;
-                }
-            case '#':
-                if (!escaped) {
-                    commented = 1;
-                    continue;
-                }
-            case '\"': 
-                if (!escaped) {
-                    quote = !quote;
-                    if (quote) continue; // don't count the quote as arg character
-                }
-            case ' ':
-                if (!escaped) {
-                    if (!quote && waschar) {
-                        // end of a non-empty argument within or outside quotes
-                        (*bp) = '\0'; // end buffer
-                        // printf("%s\n", buffer);
-                        if (!redirected) {
-                            (*ap) = malloc((strlen(buffer) + 1) * sizeof(char));
-                            if ((*ap) == NULL) {
-                                // _todo free previous memory
-                                fprintf(stderr, "Memory allocation error.\n");
-                                return NULL;
-                            }
-                            strcpy((*ap++), buffer);
-                        } else {
-                            redir = (redirected == 1) ? _redir_in : _redir_out; 
-                            if ((*redir) == NULL)
-                                (*redir) = malloc(SHELL_USERINPUT_MAX * sizeof(char));
-                            if ((*redir) == NULL) {
-                                // _todo free previous memory
-                                fprintf(stderr, "Memory allocation error.\n");
-                                return NULL;
-                            }
-                            strcpy((*redir), buffer);
-                            redirected = 0;
-                        }
-                        bp = buffer; // reset buffer position
-                        waschar = 0;
-                        continue;
-                    }
-                    if (!quote) continue; // don't count space outside quotes as arg character
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        dprintf(sv->sstdout, "data socket: %s\n", strerror(errno));
+}
+
+// handle signals of the server: dump metrics on SIGUSR1, reap finished children and advance the jobs they belonged to
+void serverSignals(server_t *sv) {
+    struct signalfd_siginfo si;
+    struct rusage ru;
+    pid_t pid;
+    int wstatus, fd, i = 0;
+    char dump = 0;
+    while (sc_read(sv->sigfd, &si, sizeof(si)) == sizeof(si)) // signals coalesce, just empty the queue
+        if (si.ssi_signo == SIGUSR1) dump = 1;
+    if (dump) statsFormat(sv->sstdout, &(sv->stats));
+    while ((pid = sc_wait4(-1, &wstatus, WNOHANG, &ru)) > 0) {
+        // find the session the stage belongs to (stages of closed connections and sessions have no owner)
+        session_t *c = NULL;
+        job_t *job = NULL;
+        for (fd = 0; fd < sv->owners_size && c == NULL; fd++) {
+            if (sv->owners[fd].conn == NULL || sv->owners[fd].session != NULL) continue; // data sockets only
+            for (c = sv->owners[fd].conn->sessions; c != NULL; c = c->next) {
+                if (c->busy) {
+                    for (i = 0; i < c->pids_count && c->pids[i] != pid; i++);
+                    if (i < c->pids_count) break;
                 }
-            default:
-                // any non-quote characters, except spaces outside quotes
-                waschar = 1;
-                (*bp++) = (*ip); // add to buffer (buffer overflow is protected outside function by max uinput size)
-                escaped = 0;
-        }
-    }
-    // if (quote) {...} // already checked during counting
-    if (waschar) {
-        // if there have been any arguments
-        // count the last unqoted argument in 
-        // quoted args have already been counted on quotes
-        (*bp) = '\0'; // end buffer
-        // printf("%s\n", buffer);
-        if (!redirected) {
-            (*ap) = malloc((strlen(buffer) + 1) * sizeof(char));
-            if ((*ap) == NULL) {
-                // _todo free previous memory
-                fprintf(stderr, "Memory allocation error.\n");
-                return NULL;
-            }
-            strcpy((*ap), buffer);
-        } else {
-            redir = (redirected == 1) ? _redir_in : _redir_out; 
-            if ((*redir) == NULL)
-                (*redir) = malloc(SHELL_USERINPUT_MAX * sizeof(char));
-            if ((*redir) == NULL) {
-                // _todo free previous memory
-                fprintf(stderr, "Memory allocation error.\n");
-                return NULL;
+                if ((job = jobReaped(&(c->jobs), pid, wstatus)) != NULL) break;
             }
-            strcpy((*redir), buffer);  
-            redirected = 0;
         }
-    }
+        if (c == NULL) continue;
+        if (job != NULL) {
+            // background job, a "wait" may be over
+            if (c->job_wait == 0 || !connJobWaited(c)) continue;
+            // the job goes on after its "wait"
+            connJobNext(sv, c);
+            if (connJobPump(sv, c)) connProcess(sv, c->conn); // next queued command
+            else connFlush(sv, c->conn);
+            continue;
+        }
 
-    // consider this to be the last command if there is nothing left after ; or |
-    if ((*_next_type) == PARG_NTYPE_SEMICOLON || (*_next_type) == PARG_NTYPE_PIPE) {
-        if (strlen(trim(*_next_input)) == 0) {
-            if ((*_next_type) == PARG_NTYPE_PIPE) {
-                fprintf(stderr, "No command after pipe.\n");
-                (*_next_type) = PARG_NTYPE_FINISHED;
-                return NULL;
-            }
-            (*_next_type) = PARG_NTYPE_FINISHED;
+        c->pids[i] = -1;
+        usageAdd(&(c->job_usage), &ru);
+        if (c->job_timing) usageAdd(&(c->time_usage), &ru);
+        if (i == c->pids_count - 1) c->job_status = wstatus;
+        if (--(c->pids_running) == 0) {
+            if (c->job_timing) c->time_usage.real += clockSeconds() - c->time_start;
+            c->job_timing = 0;
+            // whole pipeline finished, continue after ';' or end the job
+            connJobNext(sv, c);
+            if (connJobPump(sv, c)) connProcess(sv, c->conn); // next queued command
+            else connFlush(sv, c->conn);
         }
     }
-
-    return args;
 }
 
-// free arguments retreived from parseArgs
-void freeArgs(char **args, int argc, char *redir_in, char *redir_out) {
-    int i;
-    for(i = 0; i <= argc; i++) { // incl. NULL-terminated pointer at the end 
-        free(args[i]);
-        // printf("(freed arg %d)\n", i);
-    }
-    free(args);
-    // printf("(freed args)\n");
-    if (redir_in != NULL) free(redir_in);
-    if (redir_out != NULL) free(redir_out);
-        
-}
+// serve all connections on the listening socket s until an unrecoverable error
+// the server's own stdout and stderr are expected to be redirected into the memfds stdout_read
+int serveConnections(int s, int sstdout, int stdout_read[2]) {
+    struct epoll_event ev;
+    struct epoll_event events[SHELL_EPOLL_EVENTS];
+    server_t sv;
+    sigset_t sigchld;
+    int i, n;
 
-// handle child process behavior after successful forking
-void handleChild(char *const args[], int argc, 
-                 char *redir_in, char *redir_out, 
-                 char is_pipe, 
-                 int *pipe_left_read, int *pipe_left_write, 
-                 int *pipe_right_read, int *pipe_right_write) {
-                     
-    if (argc == 0) return;
+    memset(&sv, 0, sizeof(sv));
+    sv.s = s;
+    sv.sstdout = sstdout;
+    sv.stdout_read[JOB_STDOUT] = stdout_read[JOB_STDOUT];
+    sv.stdout_read[JOB_STDERR] = stdout_read[JOB_STDERR];
+    sv.relay_splice = 1;
+    sv.timerfd = -1;
+    int domain = AF_UNIX;
+    socklen_t domain_len = sizeof(domain);
+    getsockopt(s, SOL_SOCKET, SO_DOMAIN, &domain, &domain_len);
+    sv.nodelay = (domain == AF_INET);
+    sv.stats.started = clockSeconds();
+    shell_stats = &(sv.stats); // stats builtin
+    // new sessions start in the directory the server was started in
+    if ((sv.cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        perror("Server directory error");
+        return ERR_SOCKET;
+    }
 
-    // printf("[child]\n");
+    // children are reaped through a signalfd (the mask is restored in forked children), SIGUSR1 dumps metrics
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigaddset(&sigchld, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &sigchld, &shell_sigmask_child);
+    if ((sv.sigfd = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        perror("signalfd");
+        return ERR_SOCKET;
+    }
 
-    // open file-redirected input and output files each exists
-    // replace STDIN/STDOUT streams with these files
-    // otherwise if PIPES found, replace STDIN/STDOUT streams with PIPE_READ/PIPE_WRITE
-    if (redir_in != NULL) {
-        int in_fd = open(redir_in, O_RDONLY);
-        if (in_fd < 0) {
-            perror("Failed to open input file");
-            return;
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    if ((sv.epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll");
+        return ERR_SOCKET;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (shell_workers > 1) ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN; // a shared socket wakes one worker per connection
+    ev.data.fd = s;
+    epoll_ctl(sv.epfd, EPOLL_CTL_ADD, s, &ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = sv.sigfd;
+    epoll_ctl(sv.epfd, EPOLL_CTL_ADD, sv.sigfd, &ev);
+
+    // periodic metrics dump into the server's log
+    if (shell_metrics_interval > 0) {
+        struct itimerspec interval;
+        memset(&interval, 0, sizeof(interval));
+        interval.it_value.tv_sec = interval.it_interval.tv_sec = shell_metrics_interval;
+        if ((sv.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1
+            || timerfd_settime(sv.timerfd, 0, &interval, NULL) != 0) perror("metrics timer");
+        else {
+            ev.data.fd = sv.timerfd;
+            epoll_ctl(sv.epfd, EPOLL_CTL_ADD, sv.timerfd, &ev);
         }
-        if (dup2(in_fd, STDIN_FILENO) == -1) {
-            perror("Failed to redirect STDIN to input file");
-            return;
+    }
+
+    dprintf(sstdout, "Listening...\n");
+    while (1 == 1) {
+        if ((n = epoll_wait(sv.epfd, events, SHELL_EPOLL_EVENTS, -1)) == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll");
+            return ERR_SOCKET;
         }
-        close(in_fd);
-    } else if (is_pipe == IS_PIPE_LEFT || is_pipe == IS_PIPE_BOTH) { // only read from left
-        close((*pipe_left_write)); (*pipe_left_write) = -1;
-        if (dup2((*pipe_left_read), STDIN_FILENO) == -1) {
-            perror("Failed to redirect STDIN to the read end of the left pipe");
-            return;
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == s) serverAccept(&sv);
+            else if (fd == sv.sigfd) serverSignals(&sv);
+            else if (fd == sv.timerfd) {
+                uint64_t expirations;
+                if (sc_read(sv.timerfd, &expirations, sizeof(expirations)) > 0) statsFormat(sstdout, &(sv.stats));
+            }
+            else if (fd < sv.owners_size && sv.owners[fd].conn != NULL) {
+                conn_t *c = sv.owners[fd].conn;
+                session_t *se = sv.owners[fd].session;
+                if (se != NULL) {
+                    // job output is streamed to the client as it comes
+                    if (connJobPump(&sv, se)) connProcess(&sv, c); // next queued command
+                    else connFlush(&sv, c);
+                } else {
+                    if (events[i].events & EPOLLOUT) {
+                        if (connFlush(&sv, c)) continue;
+                        // room for the rest of finished jobs' output (the pipes may not signal again)
+                        char ended = 0;
+                        for (se = c->sessions; se != NULL; se = se->next)
+                            if (se->busy && (se->job_done || se->job_drain) && connJobPump(&sv, se)) ended = 1;
+                        if (ended && connProcess(&sv, c)) continue;
+                    }
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) connRead(&sv, c);
+                }
+            }
         }
-        close((*pipe_left_read)); (*pipe_left_read) = -1;
     }
+    return 0;
+}
 
-    if (redir_out != NULL) {
-        int out_fd = open(redir_out, O_WRONLY | O_CREAT, 0644);
-        if (out_fd < 0) {
-            perror("Failed to open output file");
-            return;
-        }
-        if (dup2(out_fd, STDOUT_FILENO) == -1) {
-            perror("Failed to redirect STDOUT to output file");
-            return;
+// pids of the pre-forked SERVER workers (signals to the supervisor are passed on to them)
+pid_t *server_workers = NULL;
+int server_workers_count = 0;
+
+// SIGTERM, SIGINT, SIGHUP, SIGUSR1 in the supervisor
+void serverWorkersSignal(int sig) {
+    int i;
+    for (i = 0; i < server_workers_count; i++) kill(server_workers[i], sig);
+}
+
+// AF_INET listening socket of another worker, bound to the same address (SO_REUSEPORT)
+// returns -1 on error
+int serverListen(struct sockaddr_in *addr) {
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) == -1
+        || bind(s, (struct sockaddr*)addr, sizeof(*addr)) == -1
+        || listen(s, shell_backlog) == -1) {
+        perror("worker socket");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// pre-fork shell_workers SERVER processes, the calling process only supervises them
+// AF_UNIX workers share the listening socket (*s), AF_INET workers (addr != NULL) listen on a SO_REUSEPORT socket each,
+// so the kernel spreads connections among them (the first worker takes *s, bound with SO_REUSEPORT already)
+// returns 0 in a worker (*s is its listening socket), 1 in the supervisor once every worker has ended,
+// -1 if no worker could be started
+int serverWorkers(int *s, struct sockaddr_in *addr) {
+    struct sigaction sa;
+    int i, ws, alive;
+    pid_t pid;
+    if ((server_workers = calloc(shell_workers, sizeof(pid_t))) == NULL) {
+        fprintf(stderr, "Memory allocation error.\n");
+        return -1;
+    }
+    fflush(stdout); // not printed again by every worker
+    for (i = 0; i < shell_workers; i++) {
+        ws = (addr != NULL && i > 0) ? serverListen(addr) : (*s);
+        if (ws == -1) break;
+        if ((pid = fork()) == 0) {
+            free(server_workers);
+            server_workers = NULL;
+            if (ws != (*s)) {
+                close(*s);
+                (*s) = ws;
+            }
+            return 0;
         }
-        close(out_fd);
-    } else if (is_pipe == IS_PIPE_RIGHT || is_pipe == IS_PIPE_BOTH) { // only write to right
-        close((*pipe_right_read)); (*pipe_right_read) = -1;
-        if (dup2((*pipe_right_write), STDOUT_FILENO) == -1) {
-            perror("Failed to redirect STDOUT to the write end of the right pipe");
-            return;
+        if (ws != (*s)) close(ws);
+        if (pid == -1) {
+            perror("fork");
+            break;
         }
-        close((*pipe_right_write)); (*pipe_right_write) = -1;
+        server_workers[server_workers_count++] = pid;
     }
+    if (server_workers_count == 0) return -1;
+    printf("[%d workers]\n", server_workers_count);
+    fflush(stdout);
 
-    
-
-    // man 3 exec
-    if (execvp(args[0], args) == -1) { // execvp takes the extern char **environ variable
-        perror("Failed to execute.");
-        return;
-    } 
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serverWorkersSignal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    for (alive = server_workers_count; alive > 0; ) {
+        if ((pid = waitpid(-1, NULL, 0)) != -1) alive--;
+        else if (errno != EINTR) break;
+    }
+    return 1;
 }
 
-char **allocHistory() {
+// --------------------------------------
+// client
+// --------------------------------------
+
+// request ids sent to a session and not answered yet, oldest first (ring buffer)
+typedef struct {
+    uint16_t session;
+    uint16_t *ids;
+    int head;
+    int len;
+    int size;
+} client_pending_t;
+
+// state of the CLIENT connection
+// commands are sent as they are read (pipelined), each tagged with a request id, without waiting for responses
+// and with the session they belong to ("session" commands choose it)
+typedef struct {
+    int s;                              // server socket (non-blocking)
+    char *in;                           // received frames not handled yet (PROTO_HEADER_SIZE + PROTO_PAYLOAD_MAX bytes)
+    int in_len;
+    char *out;                          // command frames not sent yet
+    int out_len;
+    int out_sent;
+    int out_size;
+    uint16_t next_id;                   // id of the next command (never 0)
+    int outstanding;                    // commands without a response
+    client_pending_t *pending;          // their ids, per session (responses of a session come in order)
+    int pending_count;
+    char quitting;                      // "quit" was sent, the server closes the connection after the responses
+    uint16_t session;                   // session the commands go to
+    uint16_t sessions[SHELL_SESSIONS_MAX]; // open sessions (session 0 is open from the start)
+    int sessions_count;
+} client_t;
+
+// unanswered ids of a session, created if requested
+// returns NULL if there are none (or on a memory allocation error)
+client_pending_t *clientPending(client_t *cl, uint16_t session, char create) {
     int i;
-    char **history = malloc(SHELL_HISTORY_MAX * sizeof(char *));
-    if (history == NULL) {
-        fprintf(stderr, "Memory allocation error (history).\n");
-        return NULL;
+    for (i = 0; i < cl->pending_count; i++) if (cl->pending[i].session == session) return cl->pending + i;
+    if (!create) return NULL;
+    client_pending_t *grown = realloc(cl->pending, (cl->pending_count + 1) * sizeof(client_pending_t));
+    if (grown == NULL) return NULL;
+    cl->pending = grown;
+    memset(cl->pending + cl->pending_count, 0, sizeof(client_pending_t));
+    cl->pending[cl->pending_count].session = session;
+    return cl->pending + cl->pending_count++;
+}
+
+// remember a sent request id as the newest one waiting for a response of the session
+// returns 1 on a memory allocation error
+char clientPendingPush(client_t *cl, uint16_t session, uint16_t id) {
+    client_pending_t *p = clientPending(cl, session, 1);
+    if (p == NULL) {
+        fprintf(stderr, "Memory allocation error.\n");
+        return 1;
     }
-    for (i = 0; i < SHELL_HISTORY_MAX; i++) {
-        history[i] = malloc(SHELL_USERINPUT_MAX * sizeof(char));
-        if (history[i] == NULL) {
-            fprintf(stderr, "Memory allocation error (history).\n");
-            return NULL;
+    if (p->len == p->size) { // grow the ring, its ids are moved to the start in order
+        int size = p->size ? p->size * 2 : 64;
+        uint16_t *grown = malloc(size * sizeof(uint16_t));
+        int i;
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            return 1;
+        }
+        for (i = 0; i < p->len; i++) grown[i] = p->ids[(p->head + i) % p->size];
+        free(p->ids);
+        p->ids = grown;
+        p->size = size;
+        p->head = 0;
+    }
+    p->ids[(p->head + p->len) % p->size] = id;
+    p->len++;
+    return 0;
+}
+
+// append a frame (PROTO_CMD or PROTO_CLOSE) for the current session to the output of the client
+// returns 1 on a memory allocation error
+char clientQueue(client_t *cl, unsigned char type, const char *cmd) {
+    int len = strlen(cmd);
+    if (cl->out_sent == cl->out_len) cl->out_sent = cl->out_len = 0;
+    if (cl->out_len + PROTO_HEADER_SIZE + len > cl->out_size) {
+        int size = cl->out_size ? cl->out_size : SHELL_USERINPUT_MAX;
+        while (size < cl->out_len + PROTO_HEADER_SIZE + len) size *= 2;
+        char *grown = realloc(cl->out, size);
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            return 1;
         }
+        cl->out = grown;
+        cl->out_size = size;
     }
-    return history;
+    if (clientPendingPush(cl, cl->session, cl->next_id) != 0) return 1;
+    cl->outstanding++;
+    protoEncode(cl->out + cl->out_len, type, 0, cl->next_id, cl->session, 0, len);
+    memcpy(cl->out + cl->out_len + PROTO_HEADER_SIZE, cmd, len);
+    cl->out_len += PROTO_HEADER_SIZE + len;
+    if (++(cl->next_id) == 0) cl->next_id = 1;
+    return 0;
 }
 
-void pushHistory(char **history, const char *uinput) {
+// index of the session in the open sessions of the client, -1 if it isn't open
+int clientSessionIndex(client_t *cl, uint16_t id) {
     int i;
-    char *moved = history[SHELL_HISTORY_MAX - 1];
-    for (i = SHELL_HISTORY_MAX - 1; i > 0; i--)
-        history[i] = history[i - 1];
-    history[0] = moved;
-    strcpy(history[0], uinput);
+    for (i = 0; i < cl->sessions_count && cl->sessions[i] != id; i++);
+    return (i < cl->sessions_count) ? i : -1;
 }
 
-void printHistory(char **history) {
+// "session" or "session list", "session new", "session switch n", "session close [n]" on the client
+// every one of them ends with an empty command to the current session, answered with its prompt
+// returns 1 on a memory allocation error
+char clientSession(client_t *cl, const char *arg) {
+    char *end;
+    long id;
     int i;
-    int j = 0;
-    for (i = SHELL_HISTORY_MAX - 1; i >= 0; i--) {
-        if (history[i][0] == '\0') continue;
-        printf("  %d\t%s\n", ++j, history[i]);
+    while ((*arg) == ' ') arg++;
+    if ((*arg) == '\0' || strcmp(arg, "list") == 0) {
+        for (i = 0; i < cl->sessions_count; i++)
+            printf("%c %u\n", (cl->sessions[i] == cl->session) ? '*' : ' ', cl->sessions[i]);
+    } else if (strcmp(arg, "new") == 0) {
+        uint16_t fresh = 1;
+        while (clientSessionIndex(cl, fresh) != -1) fresh++;
+        if (cl->sessions_count == SHELL_SESSIONS_MAX) fprintf(stderr, "session: too many sessions\n");
+        else {
+            cl->sessions[cl->sessions_count++] = fresh; // the server opens it with its first command
+            cl->session = fresh;
+            printf("[session %u]\n", fresh);
+        }
+    } else if (strncmp(arg, "switch ", 7) == 0 || strcmp(arg, "close") == 0 || strncmp(arg, "close ", 6) == 0) {
+        char closing = (arg[0] == 'c');
+        arg += closing ? 5 : 7;
+        id = strtol(arg, &end, 10);
+        if (closing && end == arg) id = cl->session;
+        if (end == arg && !closing) id = -1;
+        if (id < 0 || id > UINT16_MAX || (i = clientSessionIndex(cl, id)) == -1) fprintf(stderr, "session: no such session\n");
+        else if (!closing) cl->session = id;
+        else {
+            uint16_t current = cl->session;
+            cl->session = id;
+            if (clientQueue(cl, PROTO_CLOSE, "") != 0) return 1;
+            cl->sessions[i] = cl->sessions[--(cl->sessions_count)];
+            cl->session = (current == id) ? 0 : current;
+            if (clientSessionIndex(cl, cl->session) == -1) cl->sessions[cl->sessions_count++] = cl->session; // 0 opens again
+        }
+    } else fprintf(stderr, "session: unknown subcommand (list, new, switch n, close [n])\n");
+    fflush(stdout);
+    return clientQueue(cl, PROTO_CMD, "");
+}
+
+// write as much of the queued commands as the socket accepts
+// returns 1 on error
+char clientFlush(client_t *cl) {
+    while (cl->out_sent < cl->out_len) {
+        ssize_t w = send(cl->s, cl->out + cl->out_sent, cl->out_len - cl->out_sent, MSG_NOSIGNAL);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("socket write");
+            return 1;
+        }
+        cl->out_sent += w;
     }
+    return 0;
 }
 
-void freeHistory(char **history) {
-    freeArgs(history, SHELL_HISTORY_MAX - 1, NULL, NULL);
+// read from the server socket and handle every complete frame
+// output is printed to the respective stream, end of a response prints the prompt and is matched with its command
+// returns 1 if the connection ended (closed by the server or protocol error)
+char clientReceive(client_t *cl) {
+    proto_header_t header;
+    int r = sc_read(cl->s, cl->in + cl->in_len, PROTO_HEADER_SIZE + PROTO_PAYLOAD_MAX - cl->in_len);
+    if (r == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        perror("socket read");
+        return 1;
+    }
+    if (r == 0) {
+        if (!cl->quitting) fprintf(stderr, "Server closed the connection.\n");
+        return 1;
+    }
+    cl->in_len += r;
+
+    int at = 0;
+    while (cl->in_len - at >= PROTO_HEADER_SIZE) {
+        protoDecode(cl->in + at, &header);
+        if (header.length > PROTO_PAYLOAD_MAX) {
+            fprintf(stderr, "Protocol error (frame of %u bytes).\n", header.length);
+            return 1;
+        }
+        if (cl->in_len - at < PROTO_HEADER_SIZE + (int)header.length) break; // rest of the frame not received yet
+
+        char *payload = cl->in + at + PROTO_HEADER_SIZE;
+        if (header.type == PROTO_OUT) {
+            if (header.stream == PROTO_STDERR) {
+                fflush(stdout);
+                sc_write(STDERR_FILENO, payload, header.length);
+            } else fwrite(payload, 1, header.length, stdout);
+        } else if (header.type == PROTO_END) {
+            // response finished: show server's prompt of the current session (the greeting has no command)
+            // it has to answer the oldest command of its session still waiting for a response
+            if (header.id != 0) {
+                client_pending_t *p = clientPending(cl, header.session, 0);
+                if (p == NULL || p->len == 0 || p->ids[p->head] != header.id) {
+                    fprintf(stderr, "Protocol error (response %u of session %u out of order).\n", header.id, header.session);
+                    return 1;
+                }
+                p->head = (p->head + 1) % p->size;
+                p->len--;
+                cl->outstanding--;
+            }
+            if (header.session == cl->session) fwrite(payload, 1, header.length, stdout);
+            fflush(stdout);
+        }
+        at += PROTO_HEADER_SIZE + header.length;
+    }
+    cl->in_len -= at;
+    memmove(cl->in, cl->in + at, cl->in_len);
+    fflush(stdout); // output as it comes, even unfinished lines
+    return 0;
 }
 
 // unfinished implementation of arrow navigation for history (see older commits)
@@ -592,21 +4521,26 @@ int main(int argc, char* argv[]) {
     char shell_type = SHELL_TYPE_LOCAL;
     int sock_port = -1;
     char sock_path[SHELL_SOCKNAME_MAX];
+    char *shell_script = NULL;
     memset(sock_path, '\0', sizeof(sock_path));
-    if (processArgs(argc, argv, &shell_type, &sock_port, sock_path, sizeof(sock_path))) return ERR_WRONGARG;
+    if (processArgs(argc, argv, &shell_type, &sock_port, sock_path, sizeof(sock_path), &shell_script)) return ERR_WRONGARG;
 
     // socket related
     int s, r;                                   // client + server
-    int ds;                                     // server only
     fd_set rs;	                                // client deskriptory pre select()
     char use_port = sock_port == -1 ? 0 : 1;
     struct sockaddr_un sock_addr;		        // adresa pre path soket (AF_LOCAL)
     struct sockaddr_in sock_addri;		        // adresa pre port soket (AF_INET)
     // struct in_addr sock_addri_sin_addr;         // podstruktura AF_INET
 
-    // user input buffer and received message buffer (merged for now)
-    char uinput[SHELL_USERINPUT_MAX];
-    memset(uinput, '\0', sizeof(uinput));
+    // user input buffer (grows for long commands, kept for all of them)
+    int uinput_size = SHELL_USERINPUT_MAX;
+    char *uinput = calloc(uinput_size, 1);
+    if (uinput == NULL) return ERR_MALLOC;
+    reader_t *input = calloc(1, sizeof(reader_t)); // STDIN (kept when the client switches to LOCAL)
+    if (input == NULL) return ERR_MALLOC;
+    input->fd = STDIN_FILENO;
+    varsInit(); // variables start as the exported environment
 
     if (shell_type == SHELL_TYPE_CLIENT || shell_type == SHELL_TYPE_SERVER) {
         printf("[Registering a %s socket]\n", use_port ? "port-based (AF_INET) IP" : "path-based (AF_LOCAL)");
@@ -615,10 +4549,13 @@ int main(int argc, char* argv[]) {
             memset(&sock_addri, 0, sizeof(sock_addri));
             // memset(&sock_addri_sin_addr, 0, sizeof(sock_addri_sin_addr));
             sock_addri.sin_family = AF_INET;
-            sock_addri.sin_port = (u_short)sock_port;
+            sock_addri.sin_port = htons(sock_port);
             // sock_addri_sin_addr = inet_addr("127.0.0.1");
-            sock_addri.sin_addr.s_addr = inet_addr("127.0.0.1");
-            if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+            if (inet_pton(AF_INET, shell_address, &(sock_addri.sin_addr)) != 1) {
+                fprintf(stderr, "Argument [-i] must be an IPv4 address.\n");
+                return ERR_WRONGARG;
+            }
+            if ((s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
                 // vytvorenie socketu
                 perror("socket");
                 return ERR_SOCKET;
@@ -627,7 +4564,7 @@ int main(int argc, char* argv[]) {
             memset(&sock_addr, 0, sizeof(sock_addr));
             sock_addr.sun_family = AF_LOCAL;
             strcpy(sock_addr.sun_path, sock_path);	    // adresa = meno soketu (rovnake ako pouziva klient)
-            if ((s = socket(PF_LOCAL, SOCK_STREAM, 0)) == -1) {
+            if ((s = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
                 // vytvorenie socketu
                 perror("socket");
                 return ERR_SOCKET;
@@ -640,7 +4577,15 @@ int main(int argc, char* argv[]) {
     if (shell_type == SHELL_TYPE_CLIENT) {
         printf("[Running as CLIENT]\n");
 
-        char got_response = 1;
+        client_t cl;
+        memset(&cl, 0, sizeof(cl));
+        cl.s = s;
+        cl.next_id = 1;
+        cl.sessions_count = 1; // session 0
+        if ((cl.in = malloc(PROTO_HEADER_SIZE + PROTO_PAYLOAD_MAX)) == NULL) { // received frames
+            fprintf(stderr, "Memory allocation error.\n");
+            return ERR_MALLOC;
+        }
 
         if (use_port) {
             if ((connect(s, (struct sockaddr*)&sock_addri, sizeof(sock_addri))) == -1) {
@@ -648,6 +4593,7 @@ int main(int argc, char* argv[]) {
                 perror("socket connect");
                 return ERR_SOCKET;
             }
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int)); // commands leave as soon as they are queued
         } else {
             if ((connect(s, (struct sockaddr*)&sock_addr, sizeof(sock_addr))) == -1) {
                 // pripojenie na server
@@ -655,53 +4601,61 @@ int main(int argc, char* argv[]) {
                 return ERR_SOCKET;
             }
         }
-
-        // get prompt (+ protection against zero-length)
-        write(s, " ", 1);
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK); // input is read while commands are being sent
 
         // toto umoznuje klientovi cakat na vstup z terminalu (stdin) alebo zo soketu
         // co je prave pripravene, to sa obsluzi (nezalezi na poradi v akom to pride)
-        FD_ZERO(&rs);
-        FD_SET(0, &rs);
-        FD_SET(s, &rs);
-
-        while (select(s+1, &rs, NULL, NULL, NULL) > 0) {
-            if (got_response && FD_ISSET(0, &rs)) { // stdin
+        // stdin is read without waiting for responses, until SHELL_READER_BUFFER bytes of commands are unsent
+        // lines already buffered by the reader don't wait for select
+        // after the end of input (or halt), the client stays until all responses have arrived
+        struct timeval no_wait;
+        fd_set ws;
+        char input_done = 0;
+        char closed = 0;
+        while (!closed && !(input_done && cl.outstanding == 0 && !cl.quitting)) {
+            char room = !input_done && cl.out_len - cl.out_sent < SHELL_READER_BUFFER;
+            char pending = room && readerPending(input);
+            FD_ZERO(&rs);
+            FD_ZERO(&ws);
+            if (room) FD_SET(0, &rs);
+            FD_SET(s, &rs);
+            if (cl.out_sent < cl.out_len) FD_SET(s, &ws);
+            no_wait.tv_sec = no_wait.tv_usec = 0;
+            if (select(s+1, &rs, &ws, NULL, pending ? &no_wait : NULL) == -1) {
+                if (errno == EINTR) continue;
+                perror("select");
+                break;
+            }
+            if (room && (pending || FD_ISSET(0, &rs))) { // stdin
                 // user input
-                if (fgets(uinput, SHELL_USERINPUT_MAX, stdin) == NULL) return ERR_FGETS;
-                rewind(stdin);                        // remove any trailing STDIN
-                uinput[strcspn(uinput, "\n")] = '\0'; // remove trailing newline STDOUT
-                uinput[SHELL_USERINPUT_MAX - 1] = '\0'; // guarantee proper ending
-                if (uinput[0] == '\0') uinput[0] = ' '; // protection against zero-length messages (those cause communication freeze)
-                // printf("[%s]\n", uinput);
-
-                if      (strcmp(uinput, "halt") == 0) break; // only halting the client
-                write(s, uinput, strlen(uinput));
-                if      (strcmp(uinput, "quit") == 0) {
-                    shell_type = SHELL_TYPE_LOCAL;
-                    goto reselected_shell_type;
+                if (readCommand(input, &uinput, &uinput_size, isatty(STDIN_FILENO)) != 0) input_done = 1; // end of input
+                else if (strcmp(uinput, "halt") == 0) input_done = 1; // only halting the client
+                else if (strcmp(uinput, "session") == 0 || strncmp(uinput, "session ", 8) == 0) { // sessions of the connection
+                    if (clientSession(&cl, uinput + 7) != 0) break;
+                    FD_SET(s, &ws);
+                }
+                else {
+                    if (clientQueue(&cl, PROTO_CMD, uinput) != 0) break;
+                    if (strcmp(uinput, "quit") == 0) input_done = cl.quitting = 1;
+                    FD_SET(s, &ws); // try to send it right away
                 }
-                got_response = 0;
-            }
-            if (FD_ISSET(s, &rs)) { // server responded
-                memset(uinput, '\0', SHELL_USERINPUT_MAX);
-                r = read(s, uinput, SHELL_USERINPUT_MAX);
-                uinput[SHELL_USERINPUT_MAX - 1] = '\0';
-                // printf("[server response]\n");
-                printf("%s", uinput);
-                // printf("[server response end]\n");
-                // allow user input again (response finished)
-                got_response = 1;
             }
-            // connect() mnoziny meni, takze ich treba znova nastavit
-            FD_ZERO(&rs);
-            FD_SET(0, &rs);
-            FD_SET(s, &rs);
+            if (FD_ISSET(s, &ws) && clientFlush(&cl) != 0) break;
+            if (FD_ISSET(s, &rs)) closed = clientReceive(&cl); // server responded
         }
-        perror("select");	// ak server skonci, nemusi ist o chybu
+        free(cl.in);
+        free(cl.out);
+        for (r = 0; r < cl.pending_count; r++) free(cl.pending[r].ids);
+        free(cl.pending);
         close(s);
+        if (cl.quitting && closed) {
+            // the server ended the connection on quit: continue locally
+            shell_type = SHELL_TYPE_LOCAL;
+            goto reselected_shell_type;
+        }
     } else if (shell_type == SHELL_TYPE_SERVER) {
         printf("[Running as SERVER]\n");
+        promptInit();
         if (unlink(sock_path) == -1) { 
             // ak by tam uz taky bol tak sa vyhodi
             if (errno != ENOENT) { // not found error can be ignored
@@ -710,6 +4664,11 @@ int main(int argc, char* argv[]) {
             }
         }	
         if (use_port) {
+            if (shell_workers > 1 && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) == -1) {
+                // the other workers bind the same address
+                perror("socket reuseport");
+                return ERR_SOCKET;
+            }
             if (bind(s, (struct sockaddr*)&sock_addri, sizeof(sock_addri)) == -1) {	
                 // zviazat soket s lokalnou adresou
                 perror("socket bind");
@@ -722,307 +4681,100 @@ int main(int argc, char* argv[]) {
                 return ERR_SOCKET;
             }
         }
-        if (listen(s, 5) == -1) { 
+        if (listen(s, shell_backlog) == -1) { 
             // s je hlavny soket, len pocuva
-            // pocuvat, najviac 5 spojeni naraz (v rade)
+            // pocuvat, najviac shell_backlog spojeni naraz (v rade)
             perror("socket listen");
             return ERR_SOCKET;
         } 
+        if (shell_workers > 1 && (r = serverWorkers(&s, use_port ? &sock_addri : NULL)) != 0) {
+            // supervisor: the workers have ended
+            close(s);
+            free(server_workers);
+            return (r == 1) ? 0 : ERR_SOCKET;
+        }
 
         // save stdout as a new stream (used for direct printing)
-        int sstdout = dup(STDOUT_FILENO);
-        // pipe server's stdout so it won't get printed directly and can be sent as a buffer
-        int fd_pipe_server[2] = {-1, -1};
-        if(pipe(fd_pipe_server) != 0 ) {
-            perror("Internal server pipe error");
+        int sstdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        // redirect server's stdout and stderr so they won't get printed directly and can be sent as a buffer
+        // memfds grow with whatever is printed (a pipe would block the server once 64 KiB are unread)
+        int fd_server_read[2] = {-1, -1};
+        if ((fd_server_read[JOB_STDOUT] = memfd_create("seehell-stdout", MFD_CLOEXEC)) == -1
+            || (fd_server_read[JOB_STDERR] = memfd_create("seehell-stderr", MFD_CLOEXEC)) == -1) {
+            perror("Internal server output error");
             return ERR_SERVER_PIPE;
         }
-        dup2(fd_pipe_server[PIPE_WRITE], STDOUT_FILENO);
-        dup2(fd_pipe_server[PIPE_WRITE], STDERR_FILENO);
-        close(fd_pipe_server[PIPE_WRITE]);
-
-        // allow non-blocking read on empty pipe
-        // https://stackoverflow.com/questions/955962/how-to-buffer-stdout-in-memory-and-write-it-from-a-dedicated-thread#comment5333474_956269
-        long flags = fcntl(fd_pipe_server[PIPE_READ], F_GETFL);
-        flags |= O_NONBLOCK;
-        fcntl(fd_pipe_server[PIPE_READ], F_SETFL, flags);
-        
-        // use fd_pipe_server[PIPE_READ] below to retreive data to buffer
-
-        // server loop
-        dprintf(sstdout, "Listening...\n");
-        char isQuit = 0;
-        while (!isQuit) {
-            // prijat jedno spojenie (z max 5 cakajucich)
-            if ((ds = accept(s, NULL, NULL)) == -1) {
-                perror("data socket");
-                return ERR_SOCKET;
-            }
+        fflush(stdout); // startup messages belong to the terminal, not to the first client
+        dup2(fd_server_read[JOB_STDOUT], STDOUT_FILENO); // shares the file offset with fd_server_read
+        dup2(fd_server_read[JOB_STDERR], STDERR_FILENO);
 
-            // last char reserved for '\0'
-            while ((r = read(ds, &uinput, SHELL_USERINPUT_MAX - 1)) > 0) {
-                // guarantee proper ending
-                uinput[r] = '\0';
-
-                // request handling
-                dprintf(sstdout, ">> client: %s\n", uinput);
-
-                // -------------
-                // server action (different than local)
-                // -------------
-
-                // built-in command execution
-                // _todo argument parsing for built-ins (no use-case found for now)
-                char builtin = 1;
-                // no support for halt (reserved for client-only)
-                if (strcmp(uinput, "quit") == 0) {isQuit = 1; close(ds); break;} // quit (client sends quit to server, server closes connection on socket)
-                else if (strlen(uinput) >= 3 && strncmp(uinput, "cd ", 3) == 0) changedir(uinput + 3); // cd to arg
-                else if (strcmp(uinput, "cd") == 0) changedir(NULL); // cd to home on no args
-                else if (strcmp(uinput, "help") == 0) printf("%s\n", help); // print help
-                else    builtin = 0;
-                if (builtin) goto _response;
-
-                // -------------
-                // server action (completely identical with local)
-                // -------------
-                
-                // external command execution: handle each ';' and '|' delimited command
-                char shell_next_type = PARG_NTYPE_SEMICOLON; // default behavior for first run  as if next command after semicolon
-                char *shell_next_uinput = uinput; // give the full user input and move behind processed part on each execution
-                char is_pipe = IS_PIPE_NONE; // if the last run was piped as input, the next one has to receive pipe output
-                int fd_pipe_l[2] = {-1, -1}; // {read, write} pair
-                int fd_pipe_r[2] = {-1, -1}; // {read, write} pair
-                while(shell_next_type != PARG_NTYPE_FINISHED) {
-
-                    // argument preparation for program execution
-                    int shell_argc = 0;
-                    char *shell_redir_in, *shell_redir_out;
-                    char *shell_uinput = shell_next_uinput;
-                    char **shell_args = parseArgs(shell_uinput, &shell_argc, &shell_redir_in, &shell_redir_out, &shell_next_type, &shell_next_uinput);
-                    if (shell_args == NULL) continue; // error parsing arguments, command can't be processed
-            
-                    // for (i = 0; i < shell_argc; i++) printf("%s\n", shell_args[i]);
-                    // if (shell_redir_in != NULL) printf("< [%s]\n", shell_redir_in);
-                    // if (shell_redir_out != NULL) printf("> [%s]\n", shell_redir_out);
-
-                    // pipe preparation if pipe found on the right side of this command
-                    if (shell_next_type == PARG_NTYPE_PIPE) {
-                        // Create a new pipe
-                        if (pipe(fd_pipe_r) != 0) {
-                            perror("Pipe error");
-                            freeArgs(shell_args, shell_argc, shell_redir_in, shell_redir_out); 
-                            break;
-                        }
-                        // There may be either the new pipe on right or an already existing one on left + the new one
-                        is_pipe = (is_pipe == IS_PIPE_LEFT) ? IS_PIPE_BOTH : IS_PIPE_RIGHT;
-                    }
-
-                    // printf("pipes before fork: left[read %d, write %d] right[read %d, write %d]\n", 
-                    //         fd_pipe_l[PIPE_READ], fd_pipe_r[PIPE_WRITE], fd_pipe_r[PIPE_READ], fd_pipe_r[PIPE_WRITE]);
-
-                    // fork execution
-                    pid_t pid;
-                    int wstatus;
-                    pid = fork(); // man 2 fork
-                    if (pid == -1) {
-                        perror("Fork error"); 
-                        freeArgs(shell_args, shell_argc, shell_redir_in, shell_redir_out); 
-                        break;
-                    } else if (pid == 0) {
-                        // child process
-
-                        handleChild(shell_args, shell_argc, shell_redir_in, shell_redir_out, is_pipe, 
-                                    &(fd_pipe_l[PIPE_READ]), &(fd_pipe_l[PIPE_WRITE]),
-                                    &(fd_pipe_r[PIPE_READ]), &(fd_pipe_r[PIPE_WRITE])); 
-                        return ERR_EXECFAIL;
-
-                    } else {
-                        // parent process
-                        // pid is set to child pid
-
-                        if (is_pipe == IS_PIPE_LEFT || is_pipe == IS_PIPE_BOTH) {
-                            // close left-side pipes for parent process
-                            close(fd_pipe_l[PIPE_READ]); fd_pipe_l[PIPE_READ] = -1;
-                            close(fd_pipe_l[PIPE_WRITE]); fd_pipe_l[PIPE_WRITE] = -1;
-                            is_pipe = (is_pipe == IS_PIPE_BOTH) ? IS_PIPE_RIGHT : IS_PIPE_NONE;
-                        }
-                
-                        // must wait for child to finish executing
-                        // then resume interactive shell
-                        do {
-                            // wait(&wstatus); // man 2 wait
-                            waitpid(pid, &wstatus, WUNTRACED);
-                        } while (!WIFEXITED(wstatus) && !WIFSIGNALED(wstatus));
-                        // printf("child [%d] exited with status [%d]\n", pid, wstatus);
-
-                        if (is_pipe == IS_PIPE_RIGHT) { // move the pipe for next command from right to left
-                            fd_pipe_l[PIPE_READ] = fd_pipe_r[PIPE_READ]; fd_pipe_r[PIPE_READ] = -1;
-                            fd_pipe_l[PIPE_WRITE] = fd_pipe_r[PIPE_WRITE]; fd_pipe_r[PIPE_WRITE] = -1;
-                            is_pipe = IS_PIPE_LEFT; // now on the left of the next command
-                        }
-                    }
-
-                    // if (shell_next_type != PARG_NTYPE_FINISHED) {
-                    //     printf("NEXT [%c]\n", (shell_next_type == PARG_NTYPE_SEMICOLON) ? ';' : '|');
-                    //     printf("with [%s]\n", shell_next_uinput);
-                    // }
-
-                    // free arguments used in program execution
-                    freeArgs(shell_args, shell_argc, shell_redir_in, shell_redir_out);   
-                    // printf("freed shell_...\n");
-                }
-
-                // -------------
-                // server action (completely identical with local) end
-                // -------------
-
-                _response:
-
-                // show server's prompt on client at the end of the message
-                printPrompt();
-                putchar('\n');
-
-                // response handling
-                fflush(stdout);
-                memset(uinput, '\0', SHELL_USERINPUT_MAX);
-                // putchar('\0');
-                while (read(fd_pipe_server[PIPE_READ], uinput, SHELL_USERINPUT_MAX - 1) > 0) { // piped stdout to buffer
-                    uinput[SHELL_USERINPUT_MAX - 1] = '\0';
-                    // dprintf(sstdout, ">> server sent buffered response");
-                    if (write(ds, uinput, strlen(uinput)) == -1) {
-                        perror("data socket write");
-                        return ERR_SOCKET;
-                    }
-                    fflush(stdout);
-                    memset(uinput, '\0', SHELL_USERINPUT_MAX);
-                } 
-            }
-            perror("data socket read");
-            close(ds);
-        }
+        // server loop (all connections at once)
+        r = serveConnections(s, sstdout, fd_server_read);
         close(s);
+        if (r != 0) return r;
     } else if (shell_type == SHELL_TYPE_LOCAL) {
-        printf("[Running as LOCAL]\n");
+        // batch mode for scripts and commands piped to STDIN: no prompts, no history entries
+        char batch = shell_script != NULL || !isatty(input->fd);
+        if (shell_script != NULL && (input->fd = open(shell_script, O_RDONLY | O_CLOEXEC)) == -1) {
+            perror("Failed to open the script");
+            return ERR_WRONGARG;
+        }
+        if (!batch) printf("[Running as LOCAL]\n");
+        promptInit();
         
         // command history buffers
-        char **history = allocHistory();
-        if (history == NULL) return ERR_MALLOC;
+        history_t history;
+        if (allocHistory(&history, 1) != 0) return ERR_MALLOC;
+        arena_t arena = {NULL}; // parsed command lines (reset after every line)
+        int status = 0; // exit status of the last command (exit status of a script)
+        jobs_t jobs = {NULL, 0}; // background jobs ('&')
+        jobsInit();
+        shell_history = &history; // history, jobs, wait, ... builtins
+        shell_jobs = &jobs;
 
         // interactive shell until "halt" encountered
         while (1 == 1) {
+            // finished jobs are reaped and reported before the prompt
+            if (jobs_sigchld) {
+                jobs_sigchld = 0;
+                jobsReap(&jobs);
+            }
+            jobsNotify(&jobs, !batch);
+
             // show local prompt
-            printPrompt();
+            if (!batch) {
+                printPrompt();
+                fflush(stdout);
+            }
         
             // user input
-            if (fgets(uinput, SHELL_USERINPUT_MAX, stdin) == NULL) return ERR_FGETS;
-            rewind(stdin);                        // remove any trailing STDIN
-            uinput[strcspn(uinput, "\n")] = '\0'; // remove trailing newline STDOUT
-            uinput[SHELL_USERINPUT_MAX - 1] = '\0'; // guarantee proper ending
-            pushHistory(history, uinput);         // add to history
+            if (readCommand(input, &uinput, &uinput_size, !batch) != 0) {
+                if (batch) break; // end of the script
+                return ERR_FGETS;
+            }
+            if (!batch) pushHistory(&history, uinput); // add to history
             // printf("[%s]\n", uinput);
 
-            // built-in command execution
-            // _todo argument parsing for built-ins (no use-case found for now)
-            char builtin = 1;
-            if      (strcmp(uinput, "halt") == 0) break; // break out of the interactive shell
-            else if (strcmp(uinput, "quit") == 0) break; // same behavior because there is no server in this case
-            else if (strlen(uinput) >= 3 && strncmp(uinput, "cd ", 3) == 0) changedir(uinput + 3); // cd to arg
-            else if (strcmp(uinput, "cd") == 0) changedir(NULL); // cd to home on no args
-            else if (strcmp(uinput, "help") == 0) printf("%s\n", help); // print help
-            else if (strcmp(uinput, "history") == 0) printHistory(history); // print history
-            else    builtin = 0;
-            if (builtin) continue;
-
-
-            // external command execution: handle each ';' and '|' delimited command
-            char shell_next_type = PARG_NTYPE_SEMICOLON; // default behavior for first run  as if next command after semicolon
-            char *shell_next_uinput = uinput; // give the full user input and move behind processed part on each execution
-            char is_pipe = IS_PIPE_NONE; // if the last run was piped as input, the next one has to receive pipe output
-            int fd_pipe_l[2] = {-1, -1}; // {read, write} pair
-            int fd_pipe_r[2] = {-1, -1}; // {read, write} pair
-            while(shell_next_type != PARG_NTYPE_FINISHED) {
-
-                // argument preparation for program execution
-                int shell_argc = 0;
-                char *shell_redir_in, *shell_redir_out;
-                char *shell_uinput = shell_next_uinput;
-                char **shell_args = parseArgs(shell_uinput, &shell_argc, &shell_redir_in, &shell_redir_out, &shell_next_type, &shell_next_uinput);
-                if (shell_args == NULL) continue; // error parsing arguments, command can't be processed
-            
-                // for (i = 0; i < shell_argc; i++) printf("%s\n", shell_args[i]);
-                // if (shell_redir_in != NULL) printf("< [%s]\n", shell_redir_in);
-                // if (shell_redir_out != NULL) printf("> [%s]\n", shell_redir_out);
-
-                // pipe preparation if pipe found on the right side of this command
-                if (shell_next_type == PARG_NTYPE_PIPE) {
-                    // Create a new pipe
-                    if (pipe(fd_pipe_r) != 0) {
-                        perror("Pipe error");
-                        freeArgs(shell_args, shell_argc, shell_redir_in, shell_redir_out); 
-                        break;
-                    }
-                    // There may be either the new pipe on right or an already existing one on left + the new one
-                    is_pipe = (is_pipe == IS_PIPE_LEFT) ? IS_PIPE_BOTH : IS_PIPE_RIGHT;
-                }
-
-                // printf("pipes before fork: left[read %d, write %d] right[read %d, write %d]\n", 
-                //         fd_pipe_l[PIPE_READ], fd_pipe_r[PIPE_WRITE], fd_pipe_r[PIPE_READ], fd_pipe_r[PIPE_WRITE]);
-
-                // fork execution
-                pid_t pid;
-                int wstatus;
-                pid = fork(); // man 2 fork
-                if (pid == -1) {
-                    perror("Fork error"); 
-                    freeArgs(shell_args, shell_argc, shell_redir_in, shell_redir_out); 
-                    break;
-                } else if (pid == 0) {
-                    // child process
-
-                    handleChild(shell_args, shell_argc, shell_redir_in, shell_redir_out, is_pipe, 
-                                &(fd_pipe_l[PIPE_READ]), &(fd_pipe_l[PIPE_WRITE]),
-                                &(fd_pipe_r[PIPE_READ]), &(fd_pipe_r[PIPE_WRITE])); 
-                    return ERR_EXECFAIL;
-
-                } else {
-                    // parent process
-                    // pid is set to child pid
-
-                    if (is_pipe == IS_PIPE_LEFT || is_pipe == IS_PIPE_BOTH) {
-                        // close left-side pipes for parent process
-                        close(fd_pipe_l[PIPE_READ]); fd_pipe_l[PIPE_READ] = -1;
-                        close(fd_pipe_l[PIPE_WRITE]); fd_pipe_l[PIPE_WRITE] = -1;
-                        is_pipe = (is_pipe == IS_PIPE_BOTH) ? IS_PIPE_RIGHT : IS_PIPE_NONE;
-                    }
-                
-                    // must wait for child to finish executing
-                    // then resume interactive shell
-                    do {
-                        // wait(&wstatus); // man 2 wait
-                        waitpid(pid, &wstatus, WUNTRACED);
-                    } while (!WIFEXITED(wstatus) && !WIFSIGNALED(wstatus));
-                    // printf("child [%d] exited with status [%d]\n", pid, wstatus);
-
-                    if (is_pipe == IS_PIPE_RIGHT) { // move the pipe for next command from right to left
-                        fd_pipe_l[PIPE_READ] = fd_pipe_r[PIPE_READ]; fd_pipe_r[PIPE_READ] = -1;
-                        fd_pipe_l[PIPE_WRITE] = fd_pipe_r[PIPE_WRITE]; fd_pipe_r[PIPE_WRITE] = -1;
-                        is_pipe = IS_PIPE_LEFT; // now on the left of the next command
-                    }
-                }
-
-                // if (shell_next_type != PARG_NTYPE_FINISHED) {
-                //     printf("NEXT [%c]\n", (shell_next_type == PARG_NTYPE_SEMICOLON) ? ';' : '|');
-                //     printf("with [%s]\n", shell_next_uinput);
-                // }
+            // shell control (the other builtins are found in any stage of the line, see builtins)
+            if (strcmp(uinput, "halt") == 0) break; // break out of the interactive shell
+            if (strcmp(uinput, "quit") == 0) break; // same behavior because there is no server in this case
 
-                // free arguments used in program execution
-                freeArgs(shell_args, shell_argc, shell_redir_in, shell_redir_out);   
-                // printf("freed shell_...\n");
+            // command execution
+            usage_t usage;
+            status = exitStatus(runInput(&arena, uinput, shell_timing ? &usage : NULL, &jobs));
+            shell_status = status; // "$?" of the next line
+            if (shell_timing) {
+                char usage_line[256];
+                usageFormat(usage_line, sizeof(usage_line), &usage);
+                fprintf(stderr, "[time] %s: %s\n", uinput, usage_line); // -t
             }
      
         };
-        freeHistory(history);
+        arenaFree(&arena);
+        jobsFree(&jobs);
+        freeHistory(&history);
         // printf("freed history\n");
+        if (batch) return status;
     }
 
     return 0;
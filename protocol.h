@@ -0,0 +1,98 @@
+// client/server protocol of seeHell
+// every message is a frame: fixed-size header (network byte order) followed by header.length bytes of payload
+// payloads are binary-safe (no reliance on '\0' or on read/write timing)
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+// frame types
+#define PROTO_CMD 1             // client -> server: command line to execute (payload)
+#define PROTO_OUT 2             // server -> client: output chunk of the command (payload, stream)
+#define PROTO_END 3             // server -> client: end of response (status = exit status, payload = prompt)
+#define PROTO_CLOSE 4           // client -> server: close the session (answered by PROTO_END once its earlier commands are done)
+
+// output streams
+#define PROTO_STDOUT 1
+#define PROTO_STDERR 2
+
+// header layout: type(1) stream(1) id(2) session(2) status(4) length(4)
+// id tags a command, the frames of its response carry the same id (0: output not tied to a command, e.g. background jobs)
+// session selects one of the independent shells of the connection (own cwd, history, jobs), a command for a session
+// that isn't open opens it, session 0 is open from the start (greeted with a prompt)
+// responses of a session come in the order of its commands, so a client may send commands without waiting for responses
+#define PROTO_HEADER_SIZE 14
+#define PROTO_PAYLOAD_MAX 65536 // largest output payload a peer accepts (commands may be up to the server's ARG_MAX)
+
+typedef struct {
+    unsigned char type;
+    unsigned char stream;
+    uint16_t id;
+    uint16_t session;
+    int32_t status;
+    uint32_t length;
+} proto_header_t;
+
+// serialize header into buffer (PROTO_HEADER_SIZE bytes)
+static inline void protoEncode(char *buffer, unsigned char type, unsigned char stream, uint16_t id, uint16_t session, int32_t status, uint32_t length) {
+    uint32_t n;
+    uint16_t i = htons(id);
+    buffer[0] = type;
+    buffer[1] = stream;
+    memcpy(buffer + 2, &i, 2);
+    i = htons(session);
+    memcpy(buffer + 4, &i, 2);
+    n = htonl((uint32_t)status);
+    memcpy(buffer + 6, &n, 4);
+    n = htonl(length);
+    memcpy(buffer + 10, &n, 4);
+}
+
+// deserialize header from buffer (PROTO_HEADER_SIZE bytes)
+static inline void protoDecode(const char *buffer, proto_header_t *header) {
+    uint32_t n;
+    uint16_t i;
+    header->type = buffer[0];
+    header->stream = buffer[1];
+    memcpy(&i, buffer + 2, 2);
+    header->id = ntohs(i);
+    memcpy(&i, buffer + 4, 2);
+    header->session = ntohs(i);
+    memcpy(&n, buffer + 6, 4);
+    header->status = (int32_t)ntohl(n);
+    memcpy(&n, buffer + 10, 4);
+    header->length = ntohl(n);
+}
+
+// send a whole frame on a blocking descriptor
+// returns 0 on success, -1 on error (errno set)
+static inline int protoSend(int fd, unsigned char type, unsigned char stream, uint16_t id, uint16_t session, int32_t status, const void *payload, uint32_t length) {
+    char header[PROTO_HEADER_SIZE];
+    struct iovec iov[2];
+    ssize_t w;
+    protoEncode(header, type, stream, id, session, status, length);
+    iov[0].iov_base = header;
+    iov[0].iov_len = PROTO_HEADER_SIZE;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = length;
+    while (iov[0].iov_len + iov[1].iov_len > 0) {
+        if ((w = writev(fd, iov, 2)) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        // skip what has been written (partial writes)
+        if ((size_t)w >= iov[0].iov_len) {
+            w -= iov[0].iov_len;
+            iov[0].iov_len = 0;
+            iov[1].iov_base = (char *)iov[1].iov_base + w;
+            iov[1].iov_len -= w;
+        } else {
+            iov[0].iov_base = (char *)iov[0].iov_base + w;
+            iov[0].iov_len -= w;
+        }
+    }
+    return 0;
+}
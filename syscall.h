@@ -1,11 +1,13 @@
 // custom syscall interface with x86 assembly
-// uses the 0x80 interrupt method (32-bit style)
+// uses the syscall instruction on x86-64, the 0x80 interrupt method (32-bit style) on i386 builds (make SC_ABI=i386)
 // "SC_HELP_NOTES" reference for other relevant used syscalls
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/resource.h>
 
 #define SC_HELP_NOTES
 #define SC_UNUSED_FUNC
@@ -13,14 +15,43 @@
 // syscall interface with assembly (syscall.S)
 // ref: https://the-linux-channel.the-toffee-project.org/index.php?page=5-tutorials-a-linux-system-call-in-c-without-a-standard-library&lang=en
 void* sc_syscall( // renamed from syscall to sc_syscall because of overlap with a library function
-    void* syscall_number, // 32 bit 0x80 interrupt based (sys_write => 4, ...)
-    // ref: http://faculty.nps.edu/cseagle/assembly/sys_call.html
+    void* syscall_number, // differs between the ABIs, see SC_NR_*
+    // ref: https://filippo.io/linux-syscall-table/ (x86-64), http://faculty.nps.edu/cseagle/assembly/sys_call.html (i386)
     void* param1,
     void* param2,
     void* param3,
-    void* param4
+    void* param4,
+    void* param5,
+    void* param6
 );
 
+// syscall numbers
+#if defined(__x86_64__)
+#define SC_NR_READ 0
+#define SC_NR_WRITE 1
+#define SC_NR_EXECVE 59
+#define SC_NR_WAIT4 61
+#define SC_NR_GETUID 102
+#define SC_NR_GETGID 104
+#define SC_NR_TIME 201
+#define SC_NR_GETDENTS64 217
+#define SC_NR_CLOCK_GETTIME 228
+#define SC_NR_DUP3 292
+#define SC_NR_PIPE2 293
+#else
+#define SC_NR_READ 3
+#define SC_NR_WRITE 4
+#define SC_NR_EXECVE 11
+#define SC_NR_TIME 13
+#define SC_NR_WAIT4 114
+#define SC_NR_GETUID 199 // getuid32 (24 is limited to 16-bit ids)
+#define SC_NR_GETGID 200 // getgid32
+#define SC_NR_GETDENTS64 220
+#define SC_NR_CLOCK_GETTIME 265
+#define SC_NR_DUP3 330
+#define SC_NR_PIPE2 331
+#endif
+
 typedef unsigned long int sc_size_t;    // in stdio.h
 typedef long int sc_ssize_t;            // in stdio.h
 typedef int sc_pid_t;                   // in stdlib.h
@@ -28,29 +59,114 @@ typedef int sc_uid_t;                   // in stdlib.h
 typedef int sc_gid_t;                   // in stdlib.h
 typedef int sc_time_t;                  // in time.h
 
-#ifndef SC_UNUSED_FUNC
+// kernel result to the libc convention: -1 with errno set on error
+static inline long sc_result(void* result) {
+    long r = (long)result;
+    if (r < 0 && r > -4096) {
+        errno = -r;
+        return -1;
+    }
+    return r;
+}
+
+// man 2 read
+static inline sc_ssize_t sc_read(int fd, void* data, sc_size_t nbytes) {
+    return (sc_ssize_t) sc_result(sc_syscall(
+        (void*)SC_NR_READ,
+        (void*)(long)fd,
+        data,
+        (void*)nbytes,
+        (void*)0, (void*)0, (void*)0    // unused
+    ));
+}
+
 // man 2 write
-static sc_ssize_t sc_write(int fd, const void* data, size_t nbytes) {
-     return (sc_ssize_t) sc_syscall(
-         (void*)4,               //stack 1 sys_write
-         (void*)(ssize_t)fd,     //stack 2
-         (void*)data,            //stack 3
-         (void*)nbytes,          //stack 4
-         (void*)0                //stack 5 unused
-     );
+static inline sc_ssize_t sc_write(int fd, const void* data, sc_size_t nbytes) {
+    return (sc_ssize_t) sc_result(sc_syscall(
+        (void*)SC_NR_WRITE,
+        (void*)(long)fd,
+        (void*)data,
+        (void*)nbytes,
+        (void*)0, (void*)0, (void*)0    // unused
+    ));
+}
+
+// man 2 pipe2
+static inline int sc_pipe2(int fds[2], int flags) {
+    return (int) sc_result(sc_syscall(
+        (void*)SC_NR_PIPE2,
+        (void*)fds,
+        (void*)(long)flags,
+        (void*)0, (void*)0, (void*)0, (void*)0  // unused
+    ));
+}
+
+// man 2 dup3 (unlike dup2, oldfd == newfd is an error)
+static inline int sc_dup3(int oldfd, int newfd, int flags) {
+    return (int) sc_result(sc_syscall(
+        (void*)SC_NR_DUP3,
+        (void*)(long)oldfd,
+        (void*)(long)newfd,
+        (void*)(long)flags,
+        (void*)0, (void*)0, (void*)0    // unused
+    ));
 }
-#endif
 
-// man 2 time
+// man 2 execve (only returns on error)
+static inline int sc_execve(const char* path, char* const argv[], char* const envp[]) {
+    return (int) sc_result(sc_syscall(
+        (void*)SC_NR_EXECVE,
+        (void*)path,
+        (void*)argv,
+        (void*)envp,
+        (void*)0, (void*)0, (void*)0    // unused
+    ));
+}
+
+// man 2 wait4 (waitpid with resource usage of the child)
+static inline sc_pid_t sc_wait4(sc_pid_t pid, int* wstatus, int options, struct rusage* usage) {
+    return (sc_pid_t) sc_result(sc_syscall(
+        (void*)SC_NR_WAIT4,
+        (void*)(long)pid,
+        (void*)wstatus,
+        (void*)(long)options,
+        (void*)usage,
+        (void*)0, (void*)0              // unused
+    ));
+}
+
+// man 2 clock_gettime
+// (a real syscall, the libc version is served by the vDSO without entering the kernel where the clock allows it)
+static inline int sc_clock_gettime(clockid_t clock, struct timespec* ts) {
+    return (int) sc_result(sc_syscall(
+        (void*)SC_NR_CLOCK_GETTIME,
+        (void*)(long)clock,
+        (void*)ts,
+        (void*)0, (void*)0, (void*)0, (void*)0  // unused
+    ));
+}
+
+// man 2 getdents64 (directory entries: struct linux_dirent64 records of d_reclen bytes)
+static inline sc_ssize_t sc_getdents64(int fd, void* dirp, sc_size_t count) {
+    return (sc_ssize_t) sc_result(sc_syscall(
+        (void*)SC_NR_GETDENTS64,
+        (void*)(long)fd,
+        dirp,
+        (void*)count,
+        (void*)0, (void*)0, (void*)0    // unused
+    ));
+}
+
+#ifndef SC_UNUSED_FUNC
+// man 2 time (the prompt reads the clock through the vDSO instead)
 static sc_time_t sc_time(void) {
     return (sc_time_t) sc_syscall(
-        (void*)13,              //stack 1 sys_time
+        (void*)SC_NR_TIME,      //stack 1 sys_time
         (void*)0,               //stack 2 can be a location for what is also the return value
-        (void*)0,               //stack 3 unused
-        (void*)0,               //stack 4 unused
-        (void*)0                //stack 5 unused
+        (void*)0, (void*)0, (void*)0, (void*)0, (void*)0  // unused
     );
 }
+#endif
 #ifndef SC_HELP_NOTES
 // time.h - conversion of given unix time
 struct tm {
@@ -68,28 +184,20 @@ struct tm *localtime(const time_t *_Time);
 #endif
 
 // man 2 getuid
-static sc_uid_t sc_getuid(void) {
-    return (sc_uid_t) sc_syscall(
-        (void*)24,              //stack 1 sys_getuid
-        (void*)0,               //stack 2 unused
-        (void*)0,               //stack 3 unused
-        (void*)0,               //stack 4 unused
-        (void*)0                //stack 5 unused
+static inline sc_uid_t sc_getuid(void) {
+    return (sc_uid_t) (long) sc_syscall(
+        (void*)SC_NR_GETUID,    //stack 1 sys_getuid
+        (void*)0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0  // unused
     );
 }
 
-#ifndef SC_UNUSED_FUNC
 // man 2 getgid
-static sc_uid_t sc_getgid(void) {
-    return (sc_uid_t) sc_syscall(
-        (void*)47,              //stack 1 sys_getgid
-        (void*)0,               //stack 2 unused
-        (void*)0,               //stack 3 unused
-        (void*)0,               //stack 4 unused
-        (void*)0                //stack 5 unused
+static inline sc_gid_t sc_getgid(void) {
+    return (sc_gid_t) (long) sc_syscall(
+        (void*)SC_NR_GETGID,    //stack 1 sys_getgid
+        (void*)0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0  // unused
     );
 }
-#endif
 
 // man 3 getpwuid
 struct passwd {
@@ -106,7 +214,7 @@ struct passwd *getpwuid(sc_uid_t uid); // builtin
 // man 2 gethostname
 #ifndef SC_HELP_NOTES
 // unistd.h
-int gethostname(char *name, sc_size_t len); 
+int gethostname(char *name, sc_size_t len);
 #endif
 
 // man 2 chdir